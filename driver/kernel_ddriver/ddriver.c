@@ -2,6 +2,8 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
 #include "ddriver_ctl.h"
@@ -27,14 +29,15 @@
                         "filp_open/cpp-filp_open-function-examples.html>"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)              /* Defaults, see disk_size / io_size */
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_MAX_IO_SZ (1024 * 1024)
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
 #define GET_HEAD_POS(disk)      (disk.head - disk.layout)
 #define FORWARD_HEAD(disk, dis) (disk.head += dis)
@@ -51,23 +54,31 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static unsigned long disk_size = CONFIG_DISK_SZ;
+module_param(disk_size, ulong, 0444);
+MODULE_PARM_DESC(disk_size, "Disk size in bytes, a multiple of io_size");
+static int io_size = CONFIG_BLOCK_SZ;
+module_param(io_size, int, 0444);
+MODULE_PARM_DESC(io_size, "I/O unit in bytes, a power of 2 from 512 to 1M");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
+    char *layout;                                     /* Disk Layout, vmalloc'ed */
     char *head;                                       /* Disk Head */
     int  read_cnt;
     int  write_cnt;
     int  seek_cnt;
     int  major_num;
     int  open_count;
-    int  layout_size;
+    u64  layout_size;
     int  iounit_size;
 };
 
 static struct ddriver disk = {
+    .layout      = NULL,
     .head        = NULL,
     .read_cnt    = 0,
     .write_cnt   = 0,
@@ -81,16 +92,53 @@ static struct ddriver disk = {
 * SECTION: Helper Functions
 *******************************************************************************/
 int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
+    if (GET_HEAD_POS(disk) >= disk.layout_size) {
         kernel_alert("disk head reach the end");
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != disk.iounit_size){
+        kernel_alert("io size %ld should align to %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
+
+int check_geometry(u64 size, int iosz){
+    if (iosz < CONFIG_BLOCK_SZ || iosz > CONFIG_MAX_IO_SZ || (iosz & (iosz - 1)) != 0) {
+        kernel_alert("io size %d must be a power of 2 in [%d, %d]", 
+                     iosz, CONFIG_BLOCK_SZ, CONFIG_MAX_IO_SZ);
+        return -EINVAL;
+    }
+    if (size == 0 || (size & (iosz - 1)) != 0) {   /* iosz is a power of 2 */
+        kernel_alert("disk size %llu must be a non-zero multiple of io size %d", size, iosz);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Reformat: the layout is reallocated and keeps what fits, the head stays put if it can */
+int apply_geometry(u64 size, int iosz){
+    u64  pos = disk.head != NULL ? GET_HEAD_POS(disk) : 0;
+    char *layout;
+    int  ret = check_geometry(size, iosz);
+    if (ret < 0)
+        return ret;
+    layout = vzalloc(size);
+    if (layout == NULL) {
+        kernel_alert("can't allocate %llu bytes of disk", size);
+        return -ENOMEM;
+    }
+    if (disk.layout != NULL) {
+        memcpy(layout, disk.layout, min(size, disk.layout_size));
+        vfree(disk.layout);
+    }
+    disk.layout      = layout;
+    disk.layout_size = size;
+    disk.iounit_size = iosz;
+    pos = pos < size ? ADDR_ROUND_UP(pos) : 0;
+    SET_HEAD(disk, pos);
+    return 0;
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
@@ -119,7 +167,7 @@ static struct file_operations file_ops = {
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
+ * @param size          Must equal to the I/O unit @io_size
  * @param offset        Ignored
  * @return ssize_t      Bytes have been read 
  */
@@ -130,18 +178,18 @@ device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
     int res = check_valid(size);
     if(res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+    if (copy_to_user(user_buffer, disk.head, disk.iounit_size))
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    FORWARD_HEAD(disk, disk.iounit_size);
     INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return disk.iounit_size;
 }
 /**
  * @brief Disk Write
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
+ * @param size          Must equal to the I/O unit @io_size
  * @param offset        Ignored
  * @return ssize_t      Bytes have been written
  */
@@ -153,17 +201,17 @@ device_write(struct file *file, const char *user_buffer, size_t size, loff_t *of
     if(res < 0)
         return res;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
+    if (copy_from_user(disk.head, user_buffer, disk.iounit_size))
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    FORWARD_HEAD(disk, disk.iounit_size);
     INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return disk.iounit_size;
 }
 /**
  * @brief Disk Seek
  * 
  * @param file          Ignored
- * @param offset        Aligned to @CONFIG_BLOCK_SZ
+ * @param offset        Aligned to the I/O unit @io_size
  * @param whence        SEEK_CUR, SEEK_SET
  * @return loff_t       cur pos
  */
@@ -172,7 +220,7 @@ device_seek(struct file *file, loff_t offset, int whence) {
     IGNORE_ARG(file);
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
     switch (whence)
@@ -201,14 +249,30 @@ static long
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     IGNORE_ARG(file);
     int ret;
+    int size32;
+    u64 size64;
     struct ddriver_state state;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+        ret = copy_to_user((u64 __user *)arg, &disk.layout_size, sizeof(u64));
         if (ret) 
             return -EFAULT;
         break;
+    case IOC_REQ_DEVICE_SIZE_LEGACY:                  /* Device Size, 32-bit ABI */
+        size32 = disk.layout_size > INT_MAX ? INT_MAX : (int)disk.layout_size;
+        ret = copy_to_user((int __user *)arg, &size32, sizeof(int));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_SET_DEVICE_SIZE:                         /* Resize / Reformat */
+        if (copy_from_user(&size64, (u64 __user *)arg, sizeof(u64)))
+            return -EFAULT;
+        return apply_geometry(size64, disk.iounit_size);
+    case IOC_SET_DEVICE_IO_SZ:
+        if (copy_from_user(&size32, (int __user *)arg, sizeof(int)))
+            return -EFAULT;
+        return apply_geometry(disk.layout_size, size32);
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
         state.read_cnt = disk.read_cnt;
         state.write_cnt = disk.write_cnt;
@@ -276,16 +340,22 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+    int ret = apply_geometry(disk_size, io_size);     /* Allocate the disk */
+    if (ret < 0) {
+        return ret;
+    }
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        vfree(disk.layout);
         return major_num;
     } 
     else {                                            /* Register success */                                                  
-        kernel_info("module loaded with device major number %d", major_num);
+        kernel_info("module loaded with device major number %d, %llu bytes, io size %d", 
+                    major_num, disk.layout_size, disk.iounit_size);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
@@ -299,6 +369,7 @@ ddriver_exit(void)
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    vfree(disk.layout);
 }
 
 module_init(ddriver_init);
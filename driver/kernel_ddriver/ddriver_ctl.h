@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <linux/ioctl.h>   
+#include <linux/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -14,8 +15,11 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, uint64_t)
+#define IOC_REQ_DEVICE_SIZE_LEGACY _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_SET_DEVICE_SIZE     _IOW(IOC_MAGIC, 7, uint64_t)
+#define IOC_SET_DEVICE_IO_SZ    _IOW(IOC_MAGIC, 8, int)
 #endif
\ No newline at end of file
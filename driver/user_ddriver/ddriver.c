@@ -1,165 +1,776 @@
-#include "stdio.h"
-#include "stdlib.h"
-#include <unistd.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include "string.h"
-#include <linux/fs.h>
-#include "ddriver_ctl.h"
-#include "stdio.h"
-#include "errno.h"
-#include <pwd.h>
-#include <time.h>
-
-extern int errno;
-
-#define USER_INFO     "INFO: "
-#define USER_ALERT    "WARNING: "
-
-#define USER_PANIC    "PANIC: "
-/******************************************************************************
-* SECTION: Macro definitions
-*******************************************************************************/   
-#define DEVICE_NAME   "ddriver"
-#define DEVICE_LOG    "ddriver_log"
-
-#define user_info(fmt, ...)\
-	do {\
-		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_alert(fmt, ...)\
-	do {\
-		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_panic(fmt, ...)\
-    do {\
-        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-    } while (0)\
-
-#define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
-#define DRIVER_DESC     "A Fake disk driver in user space"
-#define DRIVER_VERSION  "0.1.0"
-
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
-/******************************************************************************
-* SECTION: Macro Functions 
-*******************************************************************************/
-#define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#include "ddriver_dev.h"
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
-
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
-/******************************************************************************
-* SECTION: Type definitions
-*******************************************************************************/
-struct ddriver
-{
-    int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
-    int  track_num;
-    int  major_num;
-    int  layout_size;
-    int  iounit_size;
-};
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
 /* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
-struct ddriver disk = {
+const struct ddriver disk_default = {
+    .ddriver_fd  = -1,
     .read_cnt    = 0,
     .write_cnt   = 0,
     .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .profile     = DDRIVER_PROFILE_HDD,
+    .read_lat    = 2 * NSEC_PER_MSEC,       /* 2ms */       
+    .write_lat   = 1 * NSEC_PER_MSEC,       /* 1ms */
+    .seek_lat    = 4 * NSEC_PER_MSEC,       /* 4.17ms per 360 degree */
+    .xfer_lat    = 0,
     .major_num   = 0,
     .track_num   = 100,
+    .channels    = 1,
+    .queue_depth = 1,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .head        = 0,
+    .cursor      = 0,
+    .sim_time    = 0,
+    .vclock_ns   = 0,
+    .debugf      = NULL,
+    .backend     = DDRIVER_BACKEND_FILE,
+    .ops         = &file_backend_ops,
+    .mmap_base   = NULL,
+    .map_cnt     = 0,
+    .queue       = NULL,
+    .sched       = { .policy = DDRIVER_SCHED_NOOP },
+    .remote_addr = NULL,
+    .remote      = NULL,
+    .layout      = DDRIVER_LAYOUT_SINGLE,
+    .member_cnt  = 0
 };
 
-FILE *debugf = NULL;
+/* Per-device latency models, selected by DDRIVER_PROFILE or IOC_SET_DEVICE_PROFILE */
+const struct ddriver_profile_info profiles[DDRIVER_PROFILE_NUM] = {
+    [DDRIVER_PROFILE_HDD] = {
+        .id = DDRIVER_PROFILE_HDD, .name = "hdd",
+        .read_lat = 2 * NSEC_PER_MSEC, .write_lat = 1 * NSEC_PER_MSEC,
+        .seek_lat = 4 * NSEC_PER_MSEC, .xfer_lat = 0,
+        .track_num = 100, .channels = 1, .queue_depth = 1
+    },
+    [DDRIVER_PROFILE_SSD] = {                       /* SATA SSD, 8 flash channels */
+        .id = DDRIVER_PROFILE_SSD, .name = "ssd",
+        .read_lat = 60 * NSEC_PER_USEC, .write_lat = 150 * NSEC_PER_USEC,
+        .seek_lat = 0, .xfer_lat = 1 * NSEC_PER_USEC,
+        .track_num = 0, .channels = 8, .queue_depth = 32
+    },
+    [DDRIVER_PROFILE_NVME] = {                      /* PCIe NVMe, deep queues */
+        .id = DDRIVER_PROFILE_NVME, .name = "nvme",
+        .read_lat = 10 * NSEC_PER_USEC, .write_lat = 15 * NSEC_PER_USEC,
+        .seek_lat = 0, .xfer_lat = 200,
+        .track_num = 0, .channels = 16, .queue_depth = 256
+    },
+    [DDRIVER_PROFILE_RAM] = {                       /* Zero-latency RAM disk */
+        .id = DDRIVER_PROFILE_RAM, .name = "ram",
+        .read_lat = 0, .write_lat = 0,
+        .seek_lat = 0, .xfer_lat = 0,
+        .track_num = 0, .channels = 1, .queue_depth = 1024
+    },
+};
+
+/* Handles returned by ddriver_open index this table */
+struct ddriver *devs[CONFIG_MAX_DEVS] = {NULL};
+static pthread_mutex_t devs_lock = PTHREAD_MUTEX_INITIALIZER;
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+int check_valid(struct ddriver *dev, size_t size) {
+    if (size == 0 || size % dev->iounit_size != 0){
+        user_alert(dev, "io size %ld should align to %d", size, dev->iounit_size);
         return -EIO;
     }
     return 0;
 }
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
+int check_valid_iov(struct ddriver *dev, const struct iovec *iov, int iovcnt, size_t *total) {
+    int i;
     
-    if (distance == 0) {
+    if (iovcnt <= 0 || iovcnt > CONFIG_IOV_MAX) {
+        user_alert(dev, "iovcnt %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    *total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (check_valid(dev, iov[i].iov_len) < 0) {
+            return -EIO;
+        }
+        *total += iov[i].iov_len;
+    }
+    return 0;
+}
+
+/******************************************************************************
+* SECTION: Telemetry
+*******************************************************************************/
+/* [0] holds 0 ns, [i] holds [2^(i-1), 2^i) ns, the last bucket is open-ended */
+static int lat_bucket(uint64_t ns) {
+    int i = 0;
+    while (ns != 0 && i < DDRIVER_LAT_BUCKETS - 1) {
+        ns >>= 1;
+        i++;
+    }
+    return i;
+}
+
+/* Heatmap regions follow the geometry, so they restart whenever it changes */
+void account_geometry(struct ddriver *dev) {
+    memset(dev->stat.region_read, 0, sizeof(dev->stat.region_read));
+    memset(dev->stat.region_write, 0, sizeof(dev->stat.region_write));
+    dev->stat.region_size = (dev->layout_size + DDRIVER_HEAT_REGIONS - 1) / DDRIVER_HEAT_REGIONS;
+}
+
+/* Back to a fresh device: head home, every counter zeroed */
+void account_reset(struct ddriver *dev) {
+    dev->head = 0;
+    dev->cursor = 0;
+    dev->read_cnt = 0;
+    dev->write_cnt = 0;
+    dev->seek_cnt = 0;
+    memset(&dev->stat, 0, sizeof(struct ddriver_state_v2));
+    account_geometry(dev);
+}
+
+/* Head movement happens under model_lock, which also covers the running max */
+void account_seek(struct ddriver *dev, off_t from, off_t to) {
+    uint64_t dist = (uint64_t)labs(to - from);
+
+    INC_SEEKCNT(dev);
+    ATOMIC_ADD(&dev->stat.seek_cnt, 1);
+    ATOMIC_ADD(&dev->stat.seek_dist, dist);
+    if (dist > dev->stat.seek_dist_max) {
+        __atomic_store_n(&dev->stat.seek_dist_max, dist, __ATOMIC_RELAXED);
+    }
+}
+
+/* One command of size bytes at offset that took lat_ns of modeled time, lock-free */
+void account_io(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t lat_ns) {
+    uint64_t *heat;
+    uint64_t  r, chunk;
+
+    if (op == DDRIVER_OP_WRITE) {
+        INC_WRITECNT(dev);
+        ATOMIC_ADD(&dev->stat.write_cnt, 1);
+        ATOMIC_ADD(&dev->stat.write_bytes, size);
+        ATOMIC_ADD(&dev->stat.write_sect_cnt, size / dev->iounit_size);
+        ATOMIC_ADD(&dev->stat.write_lat_hist[lat_bucket(lat_ns)], 1);
+        heat = dev->stat.region_write;
+    }
+    else {
+        INC_READCNT(dev);
+        ATOMIC_ADD(&dev->stat.read_cnt, 1);
+        ATOMIC_ADD(&dev->stat.read_bytes, size);
+        ATOMIC_ADD(&dev->stat.read_sect_cnt, size / dev->iounit_size);
+        ATOMIC_ADD(&dev->stat.read_lat_hist[lat_bucket(lat_ns)], 1);
+        heat = dev->stat.region_read;
+    }
+
+    while (size > 0 && dev->stat.region_size > 0) {
+        r     = offset / dev->stat.region_size;
+        chunk = (r + 1) * dev->stat.region_size - offset;
+        if (chunk > size)
+            chunk = size;
+        ATOMIC_ADD(&heat[r < DDRIVER_HEAT_REGIONS ? r : DDRIVER_HEAT_REGIONS - 1], chunk);
+        offset += chunk;
+        size   -= chunk;
+    }
+}
+
+/* Copy the telemetry word by word, each counter read atomically */
+void account_snapshot(struct ddriver *dev, struct ddriver_state_v2 *stat) {
+    uint64_t *src = (uint64_t *)&dev->stat;
+    uint64_t *dst = (uint64_t *)stat;
+    size_t i;
+
+    for (i = 0; i < sizeof(struct ddriver_state_v2) / sizeof(uint64_t); i++) {
+        dst[i] = ATOMIC_LOAD(&src[i]);
+    }
+}
+
+/******************************************************************************
+* SECTION: Trace
+*******************************************************************************/
+static uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* DDRIVER_TRACE=1 traces next to the image, any other value is the trace path */
+int trace_open(struct ddriver *dev, const char *device_path) {
+    char trace_path[CONFIG_PATH_LEN + sizeof(DEVICE_TRACE)];
+    const char *trace_env = getenv("DDRIVER_TRACE");
+    struct ddriver_trace_hdr hdr;
+
+    if (trace_env == NULL || strcmp(trace_env, "0") == 0 || trace_env[0] == '\0') {
         return 0;
     }
+    if (strcmp(trace_env, "1") == 0) {
+        snprintf(trace_path, sizeof(trace_path), "%s" DEVICE_TRACE, device_path);
+    }
+    else {
+        snprintf(trace_path, sizeof(trace_path), "%s", trace_env);
+    }
+    dev->tracef = fopen(trace_path, "w");
+    if (dev->tracef == NULL) {
+        user_alert(dev, "can't open trace %s: %s", trace_path, strerror(errno));
+        return -errno;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DDRIVER_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version   = DDRIVER_TRACE_VERSION;
+    hdr.io_size   = dev->iounit_size;
+    hdr.disk_size = dev->layout_size;
+    hdr.profile   = dev->profile;
+    hdr.sched     = dev->sched.policy;
+    hdr.wcache_size = dev->wcache.size;
+    hdr.layout      = dev->layout;
+    hdr.members     = dev->member_cnt;
+    hdr.chunk_size  = dev->chunk_size;
+    fwrite(&hdr, sizeof(hdr), 1, dev->tracef);
+    dev->trace_t0 = trace_now();
+    user_info(dev, "tracing to %s", trace_path);
+    return 0;
+}
+
+void trace_record(struct ddriver *dev, int op, uint64_t offset, uint64_t size, uint32_t aux) {
+    struct ddriver_trace_rec rec;
+
+    if (dev->tracef == NULL) {
+        return;
+    }
+    rec.ts_ns  = trace_now() - dev->trace_t0;
+    rec.offset = offset;
+    rec.size   = size;
+    rec.op     = op;
+    rec.aux    = aux;
+    fwrite(&rec, sizeof(rec), 1, dev->tracef);
+}
+
+/* Only setters carry an argument worth replaying */
+void trace_ioctl(struct ddriver *dev, unsigned long cmd, void *arg) {
+    struct ddriver_range range;
+    uint64_t value = 0;
+    int value32;
+
+    switch (cmd)
+    {
+    case IOC_REQ_DEVICE_DISCARD:
+        memcpy(&range, arg, sizeof(struct ddriver_range));
+        trace_record(dev, DDRIVER_TRACE_DISCARD, range.offset, range.len, 0);
+        return;
+    case IOC_SET_DEVICE_SIZE:
+    case IOC_SET_DEVICE_WCACHE:
+        memcpy(&value, arg, sizeof(uint64_t));
+        break;
+    case IOC_SET_DEVICE_IO_SZ:
+    case IOC_SET_DEVICE_PROFILE:
+    case IOC_SET_DEVICE_SCHED:
+        memcpy(&value32, arg, sizeof(int));
+        value = value32;
+        break;
+    default:
+        break;
+    }
+    trace_record(dev, DDRIVER_TRACE_IOCTL, value, 0, (uint32_t)cmd);
+}
+
+/* Real mode makes the caller wait out the modeled time, other threads keep going */
+void emulate_sleep(struct ddriver *dev, uint64_t ns) {
+    if (!dev->sim_time && ns >= NSEC_PER_USEC) {
+        usleep(ns / NSEC_PER_USEC);
+    }
+}
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+/* Every modeled cost lands on the virtual clock; real mode also sleeps it */
+int emulate_delay(struct ddriver *dev, uint64_t ns) {
+    pthread_mutex_lock(&dev->model_lock);
+    dev->vclock_ns += ns;
+    pthread_mutex_unlock(&dev->model_lock);
+    emulate_sleep(dev, ns);
     return 0;
 }
+
+/* Cost of moving the head from start to end, without charging it */
+uint64_t model_rotate(struct ddriver *dev, off_t start, off_t end) {
+    uint64_t bytes_per_track;
+    uint64_t lat_per_track = dev->seek_lat;
+    uint64_t distance;
+
+    if (dev->track_num == 0 || lat_per_track == 0) {
+        return 0;
+    }
+    bytes_per_track = dev->layout_size / dev->track_num;
+    distance = (uint64_t)labs(end - start) % bytes_per_track; 
+    
+    return distance * lat_per_track / bytes_per_track;
+}
+
+/* One command overhead plus the sectors spread over the internal channels */
+uint64_t model_transfer(struct ddriver *dev, uint64_t cmd_lat, size_t size) {
+    uint64_t sectors = size / dev->iounit_size;
+    uint64_t rounds  = (sectors + dev->channels - 1) / dev->channels;
+
+    return cmd_lat + rounds * dev->xfer_lat;
+}
+
+/* One media command at offset: seek there if the head is elsewhere, then transfer. model_lock held */
+uint64_t model_access(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t *seek_ns) {
+    uint64_t seek = 0;
+
+    if (dev->member_cnt > 0) {
+        dev->head = offset + size;
+        return raid_access(dev, op, offset, size, seek_ns);
+    }
+    if (offset != dev->head) {
+        account_seek(dev, dev->head, offset);
+        seek = model_rotate(dev, dev->head, offset);
+    }
+    dev->head = offset + size;
+    if (seek_ns != NULL) {
+        *seek_ns = seek;
+    }
+    return seek + model_transfer(dev, op == DDRIVER_OP_WRITE ? dev->write_lat : dev->read_lat, size);
+}
+
+int apply_profile(struct ddriver *dev, int id) {
+    const struct ddriver_profile_info *p;
+    int i;
+
+    if (id < 0 || id >= DDRIVER_PROFILE_NUM) {
+        user_alert(dev, "unknown device profile %d", id);
+        return -EINVAL;
+    }
+    p = &profiles[id];
+    dev->profile     = p->id;
+    dev->read_lat    = p->read_lat;
+    dev->write_lat   = p->write_lat;
+    dev->seek_lat    = p->seek_lat;
+    dev->xfer_lat    = p->xfer_lat;
+    dev->track_num   = p->track_num;
+    dev->channels    = p->channels;
+    dev->queue_depth = p->queue_depth;
+    for (i = 0; i < dev->member_cnt; i++) {
+        apply_profile(dev->members[i], id);
+    }
+    return 0;
+}
+
+int lookup_profile(const char *name) {
+    int i;
+    for (i = 0; i < DDRIVER_PROFILE_NUM; i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+/* Accepts plain bytes or a K/M/G suffix, returns 0 on malformed input */
+uint64_t parse_size(const char *str) {
+    char *end;
+    uint64_t size = strtoull(str, &end, 0);
+
+    switch (*end) {
+    case 'G': case 'g': size <<= 10;                 /* fall through */
+    case 'M': case 'm': size <<= 10;                 /* fall through */
+    case 'K': case 'k': size <<= 10; end++;          break;
+    case '\0':                                       break;
+    default:            return 0;
+    }
+    return *end == '\0' ? size : 0;
+}
+
+int check_geometry(uint64_t disk_size, int io_size) {
+    if (io_size < CONFIG_BLOCK_SZ || io_size > CONFIG_MAX_IO_SZ || 
+        (io_size & (io_size - 1)) != 0) {
+        user_panic("io size %d must be a power of 2 in [%d, %d]", 
+                   io_size, CONFIG_BLOCK_SZ, CONFIG_MAX_IO_SZ);
+        return -EINVAL;
+    }
+    if (disk_size == 0 || disk_size % io_size != 0) {
+        user_panic("disk size %llu must be a non-zero multiple of io size %d", 
+                   (unsigned long long)disk_size, io_size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Grow the backing image to the requested geometry, a larger image is kept as is */
+int apply_geometry(struct ddriver *dev, uint64_t disk_size, int io_size) {
+    int ret = check_geometry(disk_size, io_size);
+    if (ret < 0)
+        return ret;
+    if (dev->map_cnt > 0) {
+        user_alert(dev, "can't change geometry with %d live mappings", dev->map_cnt);
+        return -EBUSY;
+    }
+    if (ddriver_queue_busy(dev)) {
+        user_alert(dev, "can't change geometry with requests in flight");
+        return -EBUSY;
+    }
+    emulate_delay(dev, wcache_destage(dev));
+
+    /* A composite has no image of its own, its members grow in attach */
+    ret = dev->ddriver_fd >= 0 ? posix_fallocate(dev->ddriver_fd, 0, disk_size) : 0;
+    if (ret != 0) {
+        user_panic("low space");
+        return -ret;
+    }
+    if (dev->ops != NULL) {
+        dev->ops->detach(dev);
+    }
+    dev->layout_size = disk_size;
+    dev->iounit_size = io_size;
+    dev->head        = ADDR_ROUND_UP(dev, dev->head);
+    account_geometry(dev);
+    return dev->ops != NULL ? dev->ops->attach(dev) : 0;
+}
+
+int lookup_backend(const char *name) {
+    int i;
+    for (i = 0; i < DDRIVER_BACKEND_NUM; i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+int check_range(struct ddriver *dev, off_t offset, size_t size) {
+    if (offset < 0 || (uint64_t)offset + size > dev->layout_size) {
+        user_alert(dev, "io [%ld, +%ld) beyond device size %llu", offset, size,
+                   (unsigned long long)dev->layout_size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * Charge one transfer against the model and move the clock. at_cursor picks
+ * up and advances the read/write cursor in the same critical section, so
+ * concurrent sequential callers never land on the same range.
+ */
+static int ddriver_model_io(struct ddriver *dev, int op, size_t total, off_t *offset,
+                            int at_cursor, uint64_t *cost) {
+    int hit;
+    int res = 0;
+
+    pthread_mutex_lock(&dev->model_lock);
+    if (at_cursor) {
+        *offset = dev->cursor;
+    }
+    res = check_range(dev, *offset, total);
+    if (res < 0) {
+        goto out;
+    }
+    if (!IS_ADDR_ALIGN(dev, *offset)) {
+        user_alert(dev, "offset %ld must be aligned to block size %d", 
+                      *offset, dev->iounit_size);
+        res = -EINVAL;
+        goto out;
+    }
+
+    /* The write cache answers at bus speed and leaves the head alone */
+    hit = op == DDRIVER_OP_WRITE ? wcache_write(dev, *offset, total, cost)
+                                 : wcache_read(dev, *offset, total, cost);
+    if (!hit) {
+        *cost = model_access(dev, op, *offset, total, NULL);
+    }
+    dev->vclock_ns += *cost;
+    if (at_cursor) {
+        dev->cursor = *offset + total;
+    }
+out:
+    pthread_mutex_unlock(&dev->model_lock);
+    return res;
+}
+
+/* Single path for every transfer: validate, charge and move the head, copy, count */
+static int ddriver_do_io(struct ddriver *dev, int op, const struct iovec *iov, int iovcnt, 
+                         off_t offset, int at_cursor) {
+    size_t  total;
+    ssize_t ret;
+    uint64_t cost;
+    int res;
+
+    pthread_rwlock_rdlock(&dev->geom_lock);
+    res = check_valid_iov(dev, iov, iovcnt, &total);
+    if (res < 0)
+        goto out;
+    res = ddriver_model_io(dev, op, total, &offset, at_cursor, &cost);
+    if (res < 0)
+        goto out;
+    emulate_sleep(dev, cost);
+
+    /* Positional copies, nothing shared between threads is held here */
+    if (op == DDRIVER_OP_WRITE)
+        ret = dev->ops->pwritev(dev, iov, iovcnt, offset);
+    else
+        ret = dev->ops->preadv(dev, iov, iovcnt, offset);
+    if (ret != (ssize_t)total) {
+        user_alert(dev, "%s error: %s", op == DDRIVER_OP_WRITE ? "write" : "read",
+                   ret < 0 ? strerror(errno) : "short transfer");
+        res = -EIO;
+        goto out;
+    }
+
+    account_io(dev, op, offset, total, cost);
+    trace_record(dev, op == DDRIVER_OP_WRITE ? DDRIVER_TRACE_WRITE : DDRIVER_TRACE_READ,
+                 offset, total, 0);
+    res = total;
+out:
+    pthread_rwlock_unlock(&dev->geom_lock);
+    return res;
+}
+
+struct ddriver *ddriver_get(int fd) {
+    if (fd < 0 || fd >= CONFIG_MAX_DEVS) {
+        return NULL;
+    }
+    return devs[fd];
+}
+
+int ddriver_alloc_handle(struct ddriver *dev) {
+    int i;
+    pthread_mutex_lock(&devs_lock);
+    for (i = 0; i < CONFIG_MAX_DEVS; i++) {
+        if (devs[i] == NULL) {
+            devs[i] = dev;
+            pthread_mutex_unlock(&devs_lock);
+            return i;
+        }
+    }
+    pthread_mutex_unlock(&devs_lock);
+    return -EMFILE;
+}
+
+void ddriver_lock_init(struct ddriver *dev) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&dev->model_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_rwlock_init(&dev->geom_lock, NULL);
+}
+
+void ddriver_lock_destroy(struct ddriver *dev) {
+    pthread_rwlock_destroy(&dev->geom_lock);
+    pthread_mutex_destroy(&dev->model_lock);
+}
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 按配置打开驱动，未指定的项依次取环境变量、已有镜像大小、默认值
  * 
- * @return int 文件描述符
+ * @param path 设备镜像路径，NULL时为$HOME/ddriver
+ * @param cfg 可为NULL
+ * @return int 设备句柄，每个句柄有独立的计数、延迟模型与日志
  */
-int ddriver_open(char *path) {
+int ddriver_open_ex(char *path, const struct ddriver_config *cfg) {
     int fd, ret = 0;
-    char device_path[128] = {0};
-    char log_path[128] = {0};
-    
-    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
-    sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
+    char device_path[CONFIG_PATH_LEN] = {0};
+    char log_path[CONFIG_PATH_LEN + sizeof(DEVICE_LOG)] = {0};
+    char *sim_env;
+    char *profile_env;
+    char *sched_env;
+    char *wcache_env;
+    uint64_t cost;
+    char *size_env;
+    char *backend_env;
+    char *layout_env;
+    char *remote_env;
+    char remote_addr[CONFIG_PATH_LEN + sizeof(DEVICE_SOCK) + 5];
+    uint64_t disk_size = 0;
+    int io_size = 0;
+    int backend = DDRIVER_BACKEND_FILE;
+    int layout = DDRIVER_LAYOUT_SINGLE;
+    int members = 0;
+    int chunk_size = 0;
+    int local;
+    struct stat st;
+    struct ddriver *dev;
     
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
-        return -1;
+    if (path == NULL) {
+        snprintf(device_path, sizeof(device_path), "%s/" DEVICE_NAME, 
+                 getpwuid(getuid())->pw_dir);
+    }
+    else {
+        snprintf(device_path, sizeof(device_path), "%s", path);
+    }
+    snprintf(log_path, sizeof(log_path), "%s" DEVICE_LOG, device_path);
+
+    if (cfg != NULL) {
+        disk_size  = cfg->disk_size;
+        io_size    = cfg->io_size;
+        backend    = cfg->backend;
+        layout     = cfg->layout;
+        members    = cfg->members;
+        chunk_size = cfg->chunk_size;
+    }
+    if (layout == DDRIVER_LAYOUT_SINGLE && 
+        (layout_env = getenv("DDRIVER_LAYOUT")) != NULL) {
+        layout = lookup_layout(layout_env);
+    }
+    if (layout < 0 || layout >= DDRIVER_LAYOUT_NUM) {
+        user_panic("unknown layout %d", layout);
+        return -EINVAL;
+    }
+    if (members == 0 && (size_env = getenv("DDRIVER_MEMBERS")) != NULL) {
+        members = atoi(size_env);
+    }
+    if (chunk_size == 0 && (size_env = getenv("DDRIVER_CHUNK_SZ")) != NULL) {
+        chunk_size = (int)parse_size(size_env);
+    }
+    if (backend == DDRIVER_BACKEND_FILE && 
+        (backend_env = getenv("DDRIVER_BACKEND")) != NULL) {
+        backend = lookup_backend(backend_env);
+    }
+    if (backend < 0 || backend >= DDRIVER_BACKEND_NUM) {
+        user_panic("unknown backend %d", backend);
+        return -EINVAL;
     }
 
-    if (access(device_path, F_OK) == 0) {
+    /* Composite and remote devices keep their bytes elsewhere */
+    local = layout == DDRIVER_LAYOUT_SINGLE && backend != DDRIVER_BACKEND_REMOTE;
+    fd = -1;
+    if (local && access(device_path, F_OK) == 0) {
         fd = open(device_path, O_RDWR);
     }
-    else {
+    else if (local) {
         fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
     }
-    if (fd < 0) {
-        user_panic("can't open device: %d", fd);
-        return fd;
+    if (local && fd < 0) {
+        user_panic("can't open device [%s]: %s", device_path, strerror(errno));
+        return -errno;
+    }
+
+    dev = (struct ddriver *)malloc(sizeof(struct ddriver));
+    if (dev == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -ENOMEM;
+    }
+    *dev = disk_default;
+    ddriver_lock_init(dev);
+    dev->ddriver_fd = fd;
+    dev->backend    = backend;
+    dev->layout     = layout;
+    dev->chunk_size = chunk_size > 0 ? chunk_size : CONFIG_CHUNK_SZ;
+    if (backend == DDRIVER_BACKEND_REMOTE) {
+        if ((remote_env = getenv("DDRIVER_REMOTE")) != NULL) {
+            snprintf(remote_addr, sizeof(remote_addr), "%s", remote_env);
+        }
+        else {
+            snprintf(remote_addr, sizeof(remote_addr), "unix:%s" DEVICE_SOCK, device_path);
+        }
+        dev->remote_addr = strdup(remote_addr);
+    }
+
+    if (disk_size == 0 && (size_env = getenv("DDRIVER_DISK_SZ")) != NULL) {
+        disk_size = parse_size(size_env);
+    }
+    if (layout != DDRIVER_LAYOUT_SINGLE) {
+        ret = raid_open(dev, device_path, members > 0 ? members : CONFIG_MEMBERS, 
+                        backend, &disk_size);
+        if (ret < 0) {
+            goto err_close;
+        }
+    }
+    if (disk_size == 0 && fd >= 0 && fstat(fd, &st) == 0) {
+        disk_size = st.st_size;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
+    if (disk_size == 0) {
+        disk_size = CONFIG_DISK_SZ;
+    }
+    if (io_size == 0 && (size_env = getenv("DDRIVER_IO_SZ")) != NULL) {
+        io_size = (int)parse_size(size_env);
+    }
+    if (io_size == 0) {
+        io_size = CONFIG_BLOCK_SZ;
+    }
+    ret = apply_geometry(dev, disk_size, io_size);
     if (ret < 0) {
-        user_panic("low space");
-        return ret;
+        goto err_close;
     }
 
-    debugf = fopen(log_path, "w+");
-    if (debugf == NULL) {
+    if (layout == DDRIVER_LAYOUT_SINGLE) {
+        dev->ops = backends[backend];
+        ret = dev->ops->attach(dev);
+        if (ret < 0) {
+            goto err_close;
+        }
+    }
+
+    dev->debugf = fopen(log_path, "w+");
+    if (dev->debugf == NULL) {
         user_panic("can't init log: %s", log_path);
-        return -1;
+        ret = -EIO;
+        goto err_detach;
+    }
+
+    sim_env = getenv("DDRIVER_SIMTIME");
+    dev->sim_time = (sim_env != NULL && strcmp(sim_env, "0") != 0);
+
+    profile_env = getenv("DDRIVER_PROFILE");
+    if (profile_env != NULL) {
+        ret = lookup_profile(profile_env);
+        if (ret < 0 || apply_profile(dev, ret) < 0) {
+            user_alert(dev, "unknown profile [%s], keep %s", profile_env, 
+                       profiles[dev->profile].name);
+        }
+    }
+
+    sched_env = getenv("DDRIVER_SCHED");
+    if (sched_env != NULL) {
+        ret = lookup_sched(sched_env);
+        if (ret < 0) {
+            user_alert(dev, "unknown scheduler [%s], keep %s", sched_env,
+                       sched_names[dev->sched.policy]);
+        }
+        else {
+            dev->sched.policy = ret;
+        }
+    }
+
+    wcache_env = getenv("DDRIVER_WCACHE");
+    if (wcache_env != NULL && wcache_resize(dev, parse_size(wcache_env), &cost) < 0) {
+        user_alert(dev, "can't enable write cache [%s]", wcache_env);
+    }
+
+    trace_open(dev, device_path);
+
+    ret = ddriver_alloc_handle(dev);
+    if (ret < 0) {
+        user_panic("too many open devices");
+        if (dev->tracef != NULL) {
+            fclose(dev->tracef);
+        }
+        free(dev->wcache_ext);
+        fclose(dev->debugf);
+        goto err_detach;
     }
+    return ret;
 
-    return fd;
+/* Past attach the backend holds mappings, bounce buffers or a receiver thread */
+err_detach:
+    dev->ops->detach(dev);
+err_close:
+    raid_close(dev);
+    if (fd >= 0) {
+        close(fd);
+    }
+    ddriver_lock_destroy(dev);
+    free(dev->remote_addr);
+    free(dev);
+    return ret;
+}
+/**
+ * @brief 打开驱动
+ * 
+ * @return int 设备句柄
+ */
+int ddriver_open(char *path) {
+    return ddriver_open_ex(path, NULL);
 }
 /**
  * @brief 关闭驱动
@@ -168,7 +779,36 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    int ret = 0;
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL) {
+        return -EBADF;
+    }
+
+    ddriver_queue_destroy(dev);
+    while (dev->map_cnt > 0) {
+        ddriver_unmap(fd, dev->maps[dev->map_cnt - 1].addr);
+    }
+    emulate_delay(dev, wcache_destage(dev));
+    free(dev->wcache_ext);
+    pthread_mutex_lock(&devs_lock);
+    devs[fd] = NULL;
+    pthread_mutex_unlock(&devs_lock);
+    dev->ops->detach(dev);
+    raid_close(dev);
+    if (dev->ddriver_fd >= 0 && close(dev->ddriver_fd) < 0) {
+        ret = -errno;
+    }
+    if (dev->tracef != NULL) {
+        fclose(dev->tracef);
+    }
+    if (dev->debugf != NULL) {
+        fclose(dev->debugf);
+    }
+    ddriver_lock_destroy(dev);
+    free(dev->remote_addr);
+    free(dev);
+    return ret;
 }
 /**
  * @brief 磁盘头SEEK
@@ -178,102 +818,416 @@ int ddriver_close(int fd) {
  * @param whence 
  * @return int 
  */
-int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+off_t ddriver_seek(int fd, off_t offset, int whence){
+    off_t ret = 0;
+    uint64_t ns = 0;
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
 
-    if (!IS_ADDR_ALIGN(offset)) {
-        user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
-        return -EINVAL;
+    pthread_rwlock_rdlock(&dev->geom_lock);
+    pthread_mutex_lock(&dev->model_lock);
+    switch (whence)
+    {
+    case SEEK_SET: ret = offset;                            break;
+    case SEEK_CUR: ret = dev->cursor + offset;              break;
+    case SEEK_END: ret = (off_t)dev->layout_size + offset;  break;
+    default:       ret = -1;                                break;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
-    if (ret < 0) {
-        user_panic("seek error: %s", strerror(errno));
-        return ret;
+    if (ret < 0 || !IS_ADDR_ALIGN(dev, ret) || (uint64_t)ret > dev->layout_size) {
+        user_alert(dev, "offset %ld must be aligned to block size %d and inside device", 
+                      ret, dev->iounit_size);
+        ret = -EINVAL;
+        goto out;
     }
-    emulate_rotate(fd, cur, ret);
+
+    /* Members of a composite have no shared head, they seek per command */
+    if (dev->member_cnt == 0) {
+        account_seek(dev, dev->head, ret);
+        ns = model_rotate(dev, dev->head, ret);
+        dev->vclock_ns += ns;
+    }
+    trace_record(dev, DDRIVER_TRACE_SEEK, ret, 0, 0);
+    dev->head   = ret;
+    dev->cursor = ret;
+out:
+    pthread_mutex_unlock(&dev->model_lock);
+    pthread_rwlock_unlock(&dev->geom_lock);
+    emulate_sleep(dev, ns);
     return ret;
 }
 /**
- * @brief 磁盘写入，写入大小可通过IOCTL查询
+ * @brief 磁盘写入，写入大小为设备IO单位的整数倍，一次调用只计一次传输延迟
  * 
  * @param fd 
  * @param buf 
  * @param size 
- * @return int 
+ * @return int 写入字节数
  */
 int ddriver_write(int fd, char *buf, size_t size){
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
-        
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
-
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_WRITE, &iov, 1, 0, 1);
 }
 /**
- * @brief 
+ * @brief 磁盘读出，读出大小为设备IO单位的整数倍，一次调用只计一次传输延迟
  * 
  * @param fd 
  * @param buf 
  * @param size 
- * @return int 
+ * @return int 读出字节数
  */
 int ddriver_read(int fd, char *buf, size_t size){
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_READ, &iov, 1, 0, 1);
+}
+/**
+ * @brief 向量写入，从当前磁盘头开始连续写入iovcnt段数据，每段大小为IO单位的整数倍
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 写入字节数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt){
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_WRITE, iov, iovcnt, 0, 1);
+}
+/**
+ * @brief 向量读出，从当前磁盘头开始连续读出iovcnt段数据，每段大小为IO单位的整数倍
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 读出字节数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt){
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_READ, iov, iovcnt, 0, 1);
+}
+/**
+ * @brief 定位写入，在设备内部完成寻道模拟，不依赖也不修改fd的共享偏移
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 写入位置，需与IO单位对齐
+ * @return int 写入字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_WRITE, &iov, 1, offset, 0);
+}
+/**
+ * @brief 定位读出，在设备内部完成寻道模拟，不依赖也不修改fd的共享偏移
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 读出位置，需与IO单位对齐
+ * @return int 读出字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    return ddriver_do_io(dev, DDRIVER_OP_READ, &iov, 1, offset, 0);
+}
+/**
+ * @brief 映射一段设备空间，MMAP后端零拷贝，FILE后端为回写缓冲；计数与延迟同普通IO
+ * 
+ * @param fd 
+ * @param offset 需与IO单位对齐
+ * @param len 需为IO单位的整数倍
+ * @param flags DDRIVER_MAP_READ / DDRIVER_MAP_WRITE
+ * @return void* 失败返回NULL并设置errno
+ */
+void *ddriver_map(int fd, off_t offset, size_t len, int flags){
+    struct ddriver *dev = ddriver_get(fd);
+    struct ddriver_map_region *region;
+    void *addr = NULL;
+    uint64_t cost = 0;
+    int res;
+    if (dev == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+    pthread_rwlock_rdlock(&dev->geom_lock);
+    if ((res = check_valid(dev, len)) < 0 || (res = check_range(dev, offset, len)) < 0) {
+        errno = -res;
+        goto out;
+    }
+    if (!IS_ADDR_ALIGN(dev, offset)) {
+        user_alert(dev, "offset %ld must be aligned to block size %d", 
+                      offset, dev->iounit_size);
+        errno = EINVAL;
+        goto out;
+    }
+
+    addr = dev->ops->map(dev, offset, len);
+    if (addr == NULL) {
+        goto out;
+    }
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    /* The copy ran unlocked, so the table may have filled up meanwhile */
+    pthread_mutex_lock(&dev->model_lock);
+    if (dev->map_cnt >= CONFIG_MAX_MAPS) {
+        pthread_mutex_unlock(&dev->model_lock);
+        dev->ops->unmap(dev, addr, offset, len, 0);
+        addr  = NULL;
+        errno = ENOMEM;
+        goto out;
+    }
+    /* A write-only map touches the media once, at unmap */
+    if (flags & DDRIVER_MAP_READ) {
+        cost = model_access(dev, DDRIVER_OP_READ, offset, len, NULL);
+        dev->vclock_ns += cost;
+    }
+    region = &dev->maps[dev->map_cnt++];
+    region->addr   = addr;
+    region->offset = offset;
+    region->len    = len;
+    region->flags  = flags;
+    pthread_mutex_unlock(&dev->model_lock);
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if (flags & DDRIVER_MAP_READ) {
+        emulate_sleep(dev, cost);
+        account_io(dev, DDRIVER_OP_READ, offset, len, cost);
+        trace_record(dev, DDRIVER_TRACE_READ, offset, len, 0);
+    }
+out:
+    pthread_rwlock_unlock(&dev->geom_lock);
+    return addr;
 }
 /**
- * @brief 
+ * @brief 解除映射，DDRIVER_MAP_WRITE映射在此计一次写
  * 
  * @param fd 
- * @param cmd 
- * @param arg 
+ * @param addr ddriver_map的返回值
  * @return int 
  */
-int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
+int ddriver_unmap(int fd, void *addr){
+    struct ddriver *dev = ddriver_get(fd);
+    struct ddriver_map_region region;
+    uint64_t cost = 0;
+    int i, ret;
+    if (dev == NULL)
+        return -EBADF;
+
+    pthread_rwlock_rdlock(&dev->geom_lock);
+    pthread_mutex_lock(&dev->model_lock);
+    for (i = 0; i < dev->map_cnt; i++) {
+        if (dev->maps[i].addr == addr) {
+            break;
+        }
+    }
+    if (i == dev->map_cnt) {
+        pthread_mutex_unlock(&dev->model_lock);
+        pthread_rwlock_unlock(&dev->geom_lock);
+        return -EINVAL;
+    }
+    region = dev->maps[i];
+    dev->maps[i] = dev->maps[--dev->map_cnt];
+    if (region.flags & DDRIVER_MAP_WRITE) {
+        cost = model_access(dev, DDRIVER_OP_WRITE, region.offset, region.len, NULL);
+        dev->vclock_ns += cost;
+    }
+    pthread_mutex_unlock(&dev->model_lock);
+
+    if (region.flags & DDRIVER_MAP_WRITE) {
+        emulate_sleep(dev, cost);
+        account_io(dev, DDRIVER_OP_WRITE, region.offset, region.len, cost);
+        trace_record(dev, DDRIVER_TRACE_WRITE, region.offset, region.len, 0);
+    }
+    ret = dev->ops->unmap(dev, addr, region.offset, region.len, region.flags);
+    pthread_rwlock_unlock(&dev->geom_lock);
+    return ret;
+}
+static void fill_state(struct ddriver *dev, struct ddriver_state *state) {
+    state->read_cnt = ATOMIC_LOAD(&dev->read_cnt);
+    state->write_cnt = ATOMIC_LOAD(&dev->write_cnt);
+    state->seek_cnt = ATOMIC_LOAD(&dev->seek_cnt);
+}
+
+int ddriver_do_ioctl(struct ddriver *dev, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_member_state member;
+    struct ddriver_state_v2 stat;
+    int i;
+    struct ddriver_profile_info info;
+    struct ddriver_range range;
+    int profile;
+    int sched;
+    int size32;
+    int ret;
+    uint64_t size64;
+    uint64_t cost;
+
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        memcpy(arg, &dev->layout_size, sizeof(uint64_t));
         break;
+    case IOC_REQ_DEVICE_SIZE_LEGACY:                  /* Device Size, 32-bit ABI */
+        size32 = dev->layout_size > INT_MAX ? INT_MAX : (int)dev->layout_size;
+        memcpy(arg, &size32, sizeof(int));
+        break;
+    case IOC_SET_DEVICE_SIZE:                         /* Resize / Reformat */
+        memcpy(&size64, arg, sizeof(uint64_t));
+        ret = apply_geometry(dev, size64, dev->iounit_size);
+        if (ret == 0 && dev->ddriver_fd >= 0 && ftruncate(dev->ddriver_fd, size64) < 0) {
+            return -errno;
+        }
+        return ret;
+    case IOC_SET_DEVICE_IO_SZ:
+        memcpy(&size32, arg, sizeof(int));
+        return apply_geometry(dev, dev->layout_size, size32);
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        fill_state(dev, &state);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
+    case IOC_REQ_DEVICE_MEMBER_STATE:                 /* One Member of a Composite */
+        memcpy(&member, arg, sizeof(struct ddriver_member_state));
+        if (member.member < 0 || member.member >= dev->member_cnt) {
+            return -EINVAL;
+        }
+        member.members = dev->member_cnt;
+        member.head    = dev->members[member.member]->head;
+        fill_state(dev->members[member.member], &member.state);
+        account_snapshot(dev->members[member.member], &member.stat);
+        memcpy(arg, &member, sizeof(struct ddriver_member_state));
+        break;
+    case IOC_REQ_DEVICE_STATE_V2:                     /* 64-bit Counters, Histograms, Heatmap */
+        account_snapshot(dev, &stat);
+        memcpy(arg, &stat, sizeof(struct ddriver_state_v2));
+        break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
+        if (ddriver_queue_busy(dev)) {
+            return -EBUSY;
+        }
+        ret = dev->ops->discard(dev, 0, dev->layout_size);
+        if (ret < 0) {
+            return ret;
+        }
+        dev->vclock_ns = 0;
+        account_reset(dev);
+        for (i = 0; i < dev->member_cnt; i++) {
+            account_reset(dev->members[i]);
         }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        sched = dev->sched.policy;
+        memset(&dev->sched, 0, sizeof(struct ddriver_sched_state));
+        dev->sched.policy = sched;
+        wcache_drop(dev);
+        size64 = dev->wcache.size;
+        memset(&dev->wcache, 0, sizeof(struct ddriver_wcache_state));
+        dev->wcache.size = size64;
         break;
     case IOC_REQ_DEVICE_IO_SZ:
-        memcpy(arg, &disk.iounit_size, sizeof(int));
+        memcpy(arg, &dev->iounit_size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_CLOCK:                        /* Modeled Time (ns) */
+        memcpy(arg, &dev->vclock_ns, sizeof(uint64_t));
+        break;
+    case IOC_SET_DEVICE_PROFILE:                      /* Switch Latency Model */
+        memcpy(&profile, arg, sizeof(int));
+        return apply_profile(dev, profile);
+    case IOC_REQ_DEVICE_PROFILE:                      /* Current Latency Model */
+        info = profiles[dev->profile];
+        info.read_lat    = dev->read_lat;
+        info.write_lat   = dev->write_lat;
+        info.seek_lat    = dev->seek_lat;
+        info.xfer_lat    = dev->xfer_lat;
+        info.track_num   = dev->track_num;
+        info.channels    = dev->channels;
+        info.queue_depth = dev->queue_depth;
+        memcpy(arg, &info, sizeof(struct ddriver_profile_info));
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Trim, costs nothing */
+        memcpy(&range, arg, sizeof(struct ddriver_range));
+        if (range.len == 0 || !IS_ADDR_ALIGN(dev, range.offset) || !IS_ADDR_ALIGN(dev, range.len)) {
+            return -EINVAL;
+        }
+        if (range.offset > dev->layout_size || range.len > dev->layout_size - range.offset) {
+            return -EINVAL;
+        }
+        wcache_discard(dev, range.offset, range.len);
+        ret = dev->ops->discard(dev, range.offset, range.len);
+        if (ret == 0) {
+            ATOMIC_ADD(&dev->stat.discard_cnt, 1);
+            ATOMIC_ADD(&dev->stat.discard_bytes, range.len);
+        }
+        return ret;
+    case IOC_SET_DEVICE_SCHED:                        /* Queue Scheduler */
+        memcpy(&sched, arg, sizeof(int));
+        if (sched < 0 || sched >= DDRIVER_SCHED_NUM) {
+            return -EINVAL;
+        }
+        dev->sched.policy = sched;
+        user_info(dev, "scheduler: %s", sched_names[sched]);
+        break;
+    case IOC_REQ_DEVICE_SCHED:
+        memcpy(arg, &dev->sched, sizeof(struct ddriver_sched_state));
+        break;
+    case IOC_SET_DEVICE_WCACHE:                       /* Write Cache Size, 0 Disables */
+        memcpy(&size64, arg, sizeof(uint64_t));
+        ret = wcache_resize(dev, size64, &cost);
+        emulate_delay(dev, cost);
+        return ret;
+    case IOC_REQ_DEVICE_WCACHE:
+        memcpy(arg, &dev->wcache, sizeof(struct ddriver_wcache_state));
+        break;
+    case IOC_REQ_DEVICE_FLUSH:                        /* Barrier: Dirty Data to Media */
+        emulate_delay(dev, wcache_destage(dev));
+        dev->wcache.flush_cnt++;
         break;
     default:
         break;
     }
     return 0;
-}
\ No newline at end of file
+}
+/**
+ * @brief 
+ * 
+ * @param fd 
+ * @param cmd 
+ * @param arg 
+ * @return int 
+ */
+int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
+    int ret;
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+
+    /* 
+     * Geometry and reset wait for every transfer to drain; everything else
+     * only needs a consistent model. A flush sleeps with model_lock held,
+     * which stalls other commands the way a real cache flush would.
+     */
+    if (cmd == IOC_SET_DEVICE_SIZE || cmd == IOC_SET_DEVICE_IO_SZ || cmd == IOC_REQ_DEVICE_RESET)
+        pthread_rwlock_wrlock(&dev->geom_lock);
+    else
+        pthread_rwlock_rdlock(&dev->geom_lock);
+    pthread_mutex_lock(&dev->model_lock);
+    ret = ddriver_do_ioctl(dev, cmd, arg);
+    if (ret == 0) {
+        trace_ioctl(dev, cmd, arg);
+    }
+    pthread_mutex_unlock(&dev->model_lock);
+    pthread_rwlock_unlock(&dev->geom_lock);
+    return ret;
+}
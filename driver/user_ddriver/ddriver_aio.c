@@ -0,0 +1,760 @@
+#include "ddriver_dev.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_OFF_SQ_RING) && defined(__NR_io_uring_setup)
+#define DDRIVER_HAVE_URING      1
+#endif
+
+/******************************************************************************
+* SECTION: Asynchronous queue
+*
+* Requests are charged against the device model when they are submitted: each
+* one costs seek + transfer from wherever the previous request left the head,
+* and lands on the least busy of min(channels, queue_depth) lanes. The batch
+* advances vclock by its makespan, so an HDD (one lane) still pays the sum
+* while an SSD overlaps up to 8 requests. The copies themselves run on
+* io_uring when the kernel allows it, otherwise on a small worker pool; in
+* real-time mode a completion is held back until its modeled finish time.
+*******************************************************************************/
+enum ddriver_aio_engine {
+    DDRIVER_AIO_URING,
+    DDRIVER_AIO_THREADS
+};
+
+enum ddriver_aio_state {
+    AIO_FREE,
+    AIO_PREPARED,                                    /* Handed out by ddriver_get_sqe */
+    AIO_INFLIGHT,
+    AIO_DONE
+};
+
+struct ddriver_aio_req
+{
+    struct ddriver_sqe sqe;
+    struct iovec iov;
+    uint64_t ready_ns;                               /* CLOCK_MONOTONIC, 0 means now */
+    int  res;
+    int  state;                                      /* AIO_* */
+    struct ddriver_aio_req *next;                    /* Worker list */
+};
+
+#ifdef DDRIVER_HAVE_URING
+struct ddriver_uring
+{
+    int  ring_fd;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+#endif
+
+struct ddriver_queue
+{
+    struct ddriver *dev;
+    unsigned entries;
+    struct ddriver_aio_req *reqs;
+    unsigned *free_slots;
+    unsigned  free_cnt;
+    unsigned *sq;                                    /* Prepared, not yet submitted */
+    unsigned  sq_cnt;
+    off_t    *sched_off;                             /* Scratch for one batch */
+    size_t   *sched_size;
+    unsigned *sched_order;
+    unsigned  inflight;                              /* Submitted, not yet reaped */
+    uint64_t  lane_free[CONFIG_AIO_LANES];           /* vclock when each lane idles */
+    int  engine;                                     /* DDRIVER_AIO_* */
+    pthread_mutex_t lock;
+    pthread_cond_t  done_cond;
+    /* DDRIVER_AIO_THREADS */
+    pthread_t workers[CONFIG_AIO_THREADS];
+    int  nworkers;
+    struct ddriver_aio_req *work_head;
+    struct ddriver_aio_req *work_tail;
+    pthread_cond_t  work_cond;
+    int  stop;
+#ifdef DDRIVER_HAVE_URING
+    struct ddriver_uring ring;
+    int  uring_waiter;                               /* A reaper sleeps in io_uring_enter */
+#endif
+};
+
+static uint64_t aio_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int aio_complete_res(struct ddriver_aio_req *req, ssize_t ret) {
+    if (ret == (ssize_t)req->sqe.size)
+        return ret;
+    return ret < 0 ? (int)ret : -EIO;
+}
+
+/******************************************************************************
+* SECTION: io_uring engine (raw syscalls, no liburing)
+*******************************************************************************/
+#ifdef DDRIVER_HAVE_URING
+static int uring_setup(struct ddriver_uring *ring, unsigned entries) {
+    struct io_uring_params p;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return -errno;
+    }
+    ring->ring_fd  = fd;
+    ring->sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes   = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED
+        || ring->sqes == MAP_FAILED) {
+        int err = errno;
+        if (ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_len);
+        if (ring->cq_ptr != MAP_FAILED) munmap(ring->cq_ptr, ring->cq_len);
+        if (ring->sqes != MAP_FAILED)   munmap(ring->sqes, ring->sqes_len);
+        close(fd);
+        return -err;
+    }
+
+    ring->sq_head  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->cq_head  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(struct ddriver_uring *ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->ring_fd);
+}
+
+static void uring_push(struct ddriver_queue *q, unsigned slot) {
+    struct ddriver_uring   *ring = &q->ring;
+    struct ddriver_aio_req *req  = &q->reqs[slot];
+    unsigned tail = *ring->sq_tail;
+    unsigned idx  = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = req->sqe.op == DDRIVER_OP_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = q->dev->ddriver_fd;
+    sqe->addr      = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len       = 1;
+    sqe->off       = req->sqe.offset;
+    sqe->user_data = slot;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Hand n pushed entries to the kernel, returns how many it took; on failure
+ * *err is set and the tail is rolled back over the entries it never saw */
+static unsigned uring_enter(struct ddriver_queue *q, unsigned n, int *err) {
+    struct ddriver_uring *ring = &q->ring;
+    unsigned done = 0;
+    int ret;
+
+    *err = 0;
+    while (done < n) {
+        ret = syscall(__NR_io_uring_enter, ring->ring_fd, n - done, 0, 0, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            *err = -errno;
+            __atomic_store_n(ring->sq_tail, *ring->sq_tail - (n - done), __ATOMIC_RELEASE);
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+/* Move kernel completions into their requests, q->lock held */
+static void uring_harvest(struct ddriver_queue *q) {
+    struct ddriver_uring *ring = &q->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe    *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct ddriver_aio_req *req = &q->reqs[cqe->user_data];
+        req->res   = aio_complete_res(req, cqe->res);
+        req->state = AIO_DONE;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_wait(struct ddriver_queue *q) {
+    syscall(__NR_io_uring_enter, q->ring.ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+#endif /* DDRIVER_HAVE_URING */
+
+/******************************************************************************
+* SECTION: Worker pool engine
+*******************************************************************************/
+static void *aio_worker(void *arg) {
+    struct ddriver_queue   *q = arg;
+    struct ddriver_aio_req *req;
+    ssize_t ret;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->stop && q->work_head == NULL) {
+            pthread_cond_wait(&q->work_cond, &q->lock);
+        }
+        if (q->work_head == NULL) {
+            break;
+        }
+        req = q->work_head;
+        q->work_head = req->next;
+        if (q->work_head == NULL) {
+            q->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&q->lock);
+
+        if (req->sqe.op == DDRIVER_OP_WRITE)
+            ret = q->dev->ops->pwritev(q->dev, &req->iov, 1, req->sqe.offset);
+        else
+            ret = q->dev->ops->preadv(q->dev, &req->iov, 1, req->sqe.offset);
+
+        pthread_mutex_lock(&q->lock);
+        req->res   = aio_complete_res(req, ret < 0 ? -errno : ret);
+        req->state = AIO_DONE;
+        pthread_cond_broadcast(&q->done_cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void workers_push(struct ddriver_queue *q, struct ddriver_aio_req *req) {
+    req->next = NULL;
+    if (q->work_tail != NULL)
+        q->work_tail->next = req;
+    else
+        q->work_head = req;
+    q->work_tail = req;
+}
+
+static int workers_start(struct ddriver_queue *q) {
+    int i;
+    for (i = 0; i < CONFIG_AIO_THREADS; i++) {
+        if (pthread_create(&q->workers[i], NULL, aio_worker, q) != 0) {
+            break;
+        }
+        q->nworkers++;
+    }
+    return q->nworkers > 0 ? 0 : -EAGAIN;
+}
+
+static void workers_stop(struct ddriver_queue *q) {
+    int i;
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->work_cond);
+    pthread_mutex_unlock(&q->lock);
+    for (i = 0; i < q->nworkers; i++) {
+        pthread_join(q->workers[i], NULL);
+    }
+}
+
+/******************************************************************************
+* SECTION: Device model
+*******************************************************************************/
+static int aio_check(struct ddriver *dev, struct ddriver_aio_req *req) {
+    size_t total;
+    int res;
+
+    if (req->sqe.op != DDRIVER_OP_READ && req->sqe.op != DDRIVER_OP_WRITE)
+        return -EINVAL;
+    if (req->sqe.buf == NULL)
+        return -EFAULT;
+    res = check_valid_iov(dev, &req->iov, 1, &total);
+    if (res < 0)
+        return res;
+    if (!IS_ADDR_ALIGN(dev, req->sqe.offset)) {
+        user_alert(dev, "offset %ld must be aligned to block size %d",
+                   req->sqe.offset, dev->iounit_size);
+        return -EINVAL;
+    }
+    return check_range(dev, req->sqe.offset, total);
+}
+
+/* Charge one command to the least busy lane, returns its finish time on vclock */
+static uint64_t aio_charge(struct ddriver_queue *q, int op, off_t offset, size_t size, int lanes) {
+    struct ddriver *dev = q->dev;
+    uint64_t cost = 0, seek;
+    uint64_t start;
+    int i, lane = 0;
+
+    if (op == DDRIVER_OP_WRITE ? wcache_write(dev, offset, size, &cost)
+                               : wcache_read(dev, offset, size, &cost)) {
+        /* Cache speed, head untouched */
+    }
+    else {
+        dev->sched.seek_dist += (uint64_t)labs(offset - dev->head);
+        cost = model_access(dev, op, offset, size, &seek);
+        dev->sched.seek_ns   += seek;
+    }
+
+    for (i = 1; i < lanes; i++) {
+        if (q->lane_free[i] < q->lane_free[lane])
+            lane = i;
+    }
+    start = q->lane_free[lane] > dev->vclock_ns ? q->lane_free[lane] : dev->vclock_ns;
+    q->lane_free[lane] = start + cost;
+    /* Latency as the submitter sees it, queueing behind busy lanes included */
+    account_io(dev, op, offset, size, start + cost - dev->vclock_ns);
+    return start + cost;
+}
+
+/* What the batch would have cost in seeks if served in arrival order */
+static void aio_account_fifo(struct ddriver_queue *q, const unsigned *order, unsigned n) {
+    struct ddriver *dev = q->dev;
+    off_t head = dev->head;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        off_t offset = q->sched_off[order[i]];
+        if (offset != head) {
+            dev->sched.fifo_seek_dist += (uint64_t)labs(offset - head);
+            dev->sched.fifo_seek_ns   += model_rotate(dev, head, offset);
+        }
+        head = offset + q->sched_size[order[i]];
+    }
+}
+
+static int aio_lanes(struct ddriver *dev) {
+    int lanes = dev->channels < dev->queue_depth ? dev->channels : dev->queue_depth;
+    if (lanes < 1)
+        lanes = 1;
+    /* Each member of a composite brings its own lanes */
+    if (dev->member_cnt > 0)
+        lanes *= dev->member_cnt;
+    if (lanes > CONFIG_AIO_LANES)
+        lanes = CONFIG_AIO_LANES;
+    return lanes;
+}
+
+/******************************************************************************
+* SECTION: Queue API
+*******************************************************************************/
+int ddriver_queue_busy(struct ddriver *dev) {
+    struct ddriver_queue *q = dev->queue;
+    int busy;
+    if (q == NULL)
+        return 0;
+    pthread_mutex_lock(&q->lock);
+    busy = q->inflight > 0;
+    pthread_mutex_unlock(&q->lock);
+    return busy;
+}
+
+void ddriver_queue_destroy(struct ddriver *dev) {
+    struct ddriver_queue *q = dev->queue;
+    struct ddriver_cqe cqe;
+    if (q == NULL)
+        return;
+
+    while (ddriver_queue_busy(dev)) {
+        ddriver_queue_reap(dev, &cqe, 1, 1);
+    }
+    if (q->engine == DDRIVER_AIO_THREADS) {
+        workers_stop(q);
+    }
+#ifdef DDRIVER_HAVE_URING
+    else {
+        uring_teardown(&q->ring);
+    }
+#endif
+    pthread_cond_destroy(&q->work_cond);
+    pthread_cond_destroy(&q->done_cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q->sched_order);
+    free(q->sched_size);
+    free(q->sched_off);
+    free(q->sq);
+    free(q->free_slots);
+    free(q->reqs);
+    free(q);
+    dev->queue = NULL;
+}
+
+/**
+ * @brief 为设备建立异步提交/完成队列
+ *
+ * @param fd ddriver设备handler
+ * @param entries 队列深度，0使用默认值
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_init(int fd, unsigned entries) {
+    struct ddriver *dev = ddriver_get(fd);
+    struct ddriver_queue *q;
+    const char *engine = getenv("DDRIVER_AIO");
+    unsigned i;
+    int ret = -ENOSYS;
+
+    if (dev == NULL)
+        return -EBADF;
+    if (dev->queue != NULL)
+        return -EBUSY;
+    if (entries == 0)
+        entries = CONFIG_AIO_ENTRIES;
+    if (entries > CONFIG_AIO_ENTRIES_MAX)
+        return -EINVAL;
+
+    q = calloc(1, sizeof(struct ddriver_queue));
+    if (q == NULL)
+        return -ENOMEM;
+    q->dev        = dev;
+    q->entries    = entries;
+    q->reqs       = calloc(entries, sizeof(struct ddriver_aio_req));
+    q->free_slots = calloc(entries, sizeof(unsigned));
+    q->sq         = calloc(entries, sizeof(unsigned));
+    q->sched_off   = calloc(entries, sizeof(off_t));
+    q->sched_size  = calloc(entries, sizeof(size_t));
+    q->sched_order = calloc(entries, sizeof(unsigned));
+    if (q->reqs == NULL || q->free_slots == NULL || q->sq == NULL
+        || q->sched_off == NULL || q->sched_size == NULL || q->sched_order == NULL) {
+        ret = -ENOMEM;
+        goto err_free;
+    }
+    for (i = 0; i < entries; i++) {
+        q->free_slots[i] = entries - 1 - i;
+    }
+    q->free_cnt = entries;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->done_cond, NULL);
+    pthread_cond_init(&q->work_cond, NULL);
+
+#ifdef DDRIVER_HAVE_URING
+    /* io_uring talks to the fd, the mmap backend copies through its mapping */
+    if (dev->backend == DDRIVER_BACKEND_FILE && dev->member_cnt == 0
+        && (engine == NULL || strcmp(engine, "uring") == 0)) {
+        ret = uring_setup(&q->ring, entries);
+        if (ret == 0)
+            q->engine = DDRIVER_AIO_URING;
+        else
+            user_info(dev, "io_uring unavailable (%s), using worker threads", strerror(-ret));
+    }
+#endif
+    if (ret != 0) {
+        if (engine != NULL && strcmp(engine, "uring") != 0 && strcmp(engine, "threads") != 0) {
+            user_alert(dev, "unknown DDRIVER_AIO=%s, using worker threads", engine);
+        }
+        q->engine = DDRIVER_AIO_THREADS;
+        ret = workers_start(q);
+        if (ret < 0)
+            goto err_sync;
+    }
+    dev->queue = q;
+    user_info(dev, "queue: %u entries on %s", entries,
+              q->engine == DDRIVER_AIO_URING ? "io_uring" : "worker threads");
+    return 0;
+
+err_sync:
+    pthread_cond_destroy(&q->work_cond);
+    pthread_cond_destroy(&q->done_cond);
+    pthread_mutex_destroy(&q->lock);
+err_free:
+    free(q->sched_order);
+    free(q->sched_size);
+    free(q->sched_off);
+    free(q->sq);
+    free(q->free_slots);
+    free(q->reqs);
+    free(q);
+    return ret;
+}
+
+/**
+ * @brief 取一个空闲的提交项，填好后由ddriver_submit统一提交
+ *
+ * @param fd ddriver设备handler
+ * @return struct ddriver_sqe* 提交项，队列满或未建立队列时返回NULL
+ */
+struct ddriver_sqe *ddriver_get_sqe(int fd) {
+    struct ddriver *dev = ddriver_get(fd);
+    struct ddriver_queue   *q;
+    struct ddriver_aio_req *req = NULL;
+    unsigned slot;
+
+    if (dev == NULL || dev->queue == NULL)
+        return NULL;
+    q = dev->queue;
+    pthread_mutex_lock(&q->lock);
+    if (q->free_cnt > 0) {
+        slot = q->free_slots[--q->free_cnt];
+        req  = &q->reqs[slot];
+        memset(&req->sqe, 0, sizeof(req->sqe));
+        req->state = AIO_PREPARED;
+        q->sq[q->sq_cnt++] = slot;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return req != NULL ? &req->sqe : NULL;
+}
+
+/**
+ * @brief 提交所有已填写的提交项，按调度策略排序并合并相邻请求，延迟按通道数和队列深度重叠计费
+ *
+ * @param fd ddriver设备handler
+ * @return int 提交的请求数，负数为错误码
+ */
+int ddriver_submit(int fd) {
+    struct ddriver *dev = ddriver_get(fd);
+    struct ddriver_queue *q;
+    uint64_t base, finish = 0, latest, wall;
+    unsigned i, j, n, valid = 0, pushed = 0;
+    size_t   run = 0;
+    int lanes;
+
+    if (dev == NULL)
+        return -EBADF;
+    q = dev->queue;
+    if (q == NULL)
+        return -EINVAL;
+
+    /* Lock order: geom_lock, model_lock, q->lock, same as ioctls that check the queue */
+    pthread_rwlock_rdlock(&dev->geom_lock);
+    pthread_mutex_lock(&dev->model_lock);
+    pthread_mutex_lock(&q->lock);
+    n      = q->sq_cnt;
+    lanes  = aio_lanes(dev);
+    if (q->inflight == 0) {
+        /* Idle device, also forgets lanes left over from before a reset */
+        memset(q->lane_free, 0, sizeof(q->lane_free));
+    }
+    base   = dev->vclock_ns;
+    latest = base;
+    wall   = aio_now_ns();
+    for (i = 0; i < n; i++) {
+        struct ddriver_aio_req *req = &q->reqs[q->sq[i]];
+        int res;
+
+        req->iov.iov_base = req->sqe.buf;
+        req->iov.iov_len  = req->sqe.size;
+        req->ready_ns     = 0;
+        req->state        = AIO_INFLIGHT;
+        q->inflight++;
+
+        res = aio_check(dev, req);
+        if (res < 0) {
+            req->res   = res;
+            req->state = AIO_DONE;
+            continue;
+        }
+        q->sched_off[i]  = req->sqe.offset;
+        q->sched_size[i] = req->sqe.size;
+        q->sched_order[valid++] = i;
+    }
+
+    for (i = 0; i < valid; i++) {
+        struct ddriver_aio_req *req = &q->reqs[q->sq[q->sched_order[i]]];
+        trace_record(dev, req->sqe.op == DDRIVER_OP_WRITE ? DDRIVER_TRACE_WRITE : DDRIVER_TRACE_READ,
+                     req->sqe.offset, req->sqe.size, DDRIVER_TRACE_F_QUEUED);
+    }
+    trace_record(dev, DDRIVER_TRACE_SUBMIT, 0, valid, 0);
+
+    aio_account_fifo(q, q->sched_order, valid);
+    sched_order(dev->sched.policy, dev->head, q->sched_off, q->sched_size,
+                q->sched_order, valid);
+
+    for (i = 0; i < valid; i = j) {
+        struct ddriver_aio_req *req = &q->reqs[q->sq[q->sched_order[i]]];
+        int op = req->sqe.op;
+
+        /* Fold following requests that continue this one into a single command */
+        run = req->sqe.size;
+        for (j = i + 1; j < valid && dev->sched.policy != DDRIVER_SCHED_NOOP; j++) {
+            struct ddriver_aio_req *next = &q->reqs[q->sq[q->sched_order[j]]];
+            if (next->sqe.op != op || next->sqe.offset != req->sqe.offset + (off_t)run
+                || run + next->sqe.size > CONFIG_MAX_IO_SZ) {
+                break;
+            }
+            run += next->sqe.size;
+        }
+        dev->sched.merged_cnt += j - i - 1;
+        finish = aio_charge(q, op, req->sqe.offset, run, lanes);
+        if (finish > latest)
+            latest = finish;
+
+        for (; i < j; i++) {
+            unsigned slot = q->sq[q->sched_order[i]];
+            if (!dev->sim_time)
+                q->reqs[slot].ready_ns = wall + (finish - base);
+#ifdef DDRIVER_HAVE_URING
+            if (q->engine == DDRIVER_AIO_URING) {
+                uring_push(q, slot);
+                pushed++;
+                continue;
+            }
+#endif
+            workers_push(q, &q->reqs[slot]);
+            pushed++;
+        }
+    }
+    q->sq_cnt = 0;
+    dev->vclock_ns = latest;
+    pthread_mutex_unlock(&dev->model_lock);
+
+#ifdef DDRIVER_HAVE_URING
+    if (q->engine == DDRIVER_AIO_URING && pushed > 0) {
+        int res;
+        unsigned sent = uring_enter(q, pushed, &res);
+        if (res < 0) {
+            user_alert(dev, "io_uring submit error: %s", strerror(-res));
+            /* Entries were pushed in sched_order; the first sent belong to the
+             * kernel now and complete through uring_harvest */
+            for (i = sent; i < valid; i++) {
+                struct ddriver_aio_req *req = &q->reqs[q->sq[q->sched_order[i]]];
+                req->res   = res;
+                req->state = AIO_DONE;
+            }
+            pthread_cond_broadcast(&q->done_cond);
+        }
+    }
+#endif
+    if (q->engine == DDRIVER_AIO_THREADS && pushed > 0) {
+        pthread_cond_broadcast(&q->work_cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+    pthread_rwlock_unlock(&dev->geom_lock);
+    return n;
+}
+
+int ddriver_queue_reap(struct ddriver *dev, struct ddriver_cqe *cqes, int max, int min_complete) {
+    struct ddriver_queue *q = dev->queue;
+    uint64_t now, next_ready;
+    unsigned i, pending;
+    int n = 0;
+
+    if (min_complete > max)
+        min_complete = max;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+#ifdef DDRIVER_HAVE_URING
+        /* While one reaper sleeps in the kernel only it may consume CQEs,
+         * otherwise it could be left waiting for one that was taken */
+        if (q->engine == DDRIVER_AIO_URING && !q->uring_waiter)
+            uring_harvest(q);
+#endif
+        now        = aio_now_ns();
+        next_ready = 0;
+        pending    = 0;
+        for (i = 0; i < q->entries && n < max; i++) {
+            struct ddriver_aio_req *req = &q->reqs[i];
+            if (req->state == AIO_INFLIGHT)
+                pending++;
+            if (req->state != AIO_DONE)
+                continue;
+            if (req->ready_ns > now) {
+                if (next_ready == 0 || req->ready_ns < next_ready)
+                    next_ready = req->ready_ns;
+                continue;
+            }
+            cqes[n].user_data = req->sqe.user_data;
+            cqes[n].res       = req->res;
+            n++;
+            req->state = AIO_FREE;
+            q->free_slots[q->free_cnt++] = i;
+            q->inflight--;
+        }
+        if (n >= min_complete || n >= max || q->inflight == 0)
+            break;
+
+        if (next_ready != 0) {
+            /* Data is there, the modeled device is not done yet */
+            struct timespec ts;
+            uint64_t wait = next_ready - now;
+            ts.tv_sec  = wait / 1000000000ULL;
+            ts.tv_nsec = wait % 1000000000ULL;
+            pthread_mutex_unlock(&q->lock);
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&q->lock);
+        }
+#ifdef DDRIVER_HAVE_URING
+        else if (q->engine == DDRIVER_AIO_URING && !q->uring_waiter && pending > 0) {
+            /* ddriver_submit enters the ring under q->lock, so every INFLIGHT
+             * request seen here is the kernel's and its CQE will wake us.
+             * Harvest for everyone, the others wait on done_cond */
+            q->uring_waiter = 1;
+            pthread_mutex_unlock(&q->lock);
+            uring_wait(q);
+            pthread_mutex_lock(&q->lock);
+            uring_harvest(q);
+            q->uring_waiter = 0;
+            pthread_cond_broadcast(&q->done_cond);
+        }
+#endif
+        else {
+            pthread_cond_wait(&q->done_cond, &q->lock);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+/**
+ * @brief 收割已完成的请求
+ *
+ * @param fd ddriver设备handler
+ * @param cqes 完成项数组
+ * @param max 最多收割个数
+ * @param min_complete 至少等到这么多个完成才返回，0为不等待
+ * @return int 收割到的完成项个数，负数为错误码
+ */
+int ddriver_reap(int fd, struct ddriver_cqe *cqes, int max, int min_complete) {
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    if (dev->queue == NULL || cqes == NULL || max <= 0 || min_complete < 0)
+        return -EINVAL;
+    return ddriver_queue_reap(dev, cqes, max, min_complete);
+}
+
+/**
+ * @brief 等待所有在途请求完成并释放队列
+ *
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_exit(int fd) {
+    struct ddriver *dev = ddriver_get(fd);
+    if (dev == NULL)
+        return -EBADF;
+    if (dev->queue == NULL)
+        return -EINVAL;
+    ddriver_queue_destroy(dev);
+    return 0;
+}
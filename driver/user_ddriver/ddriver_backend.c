@@ -0,0 +1,310 @@
+#define _GNU_SOURCE                                  /* fallocate */
+#include "ddriver_dev.h"
+
+/******************************************************************************
+* SECTION: File Backend
+*******************************************************************************/
+/* Every transfer is one positional syscall against the image */
+int file_attach(struct ddriver *dev) {
+    IGNORE_ARG(dev);
+    return 0;
+}
+
+void file_detach(struct ddriver *dev) {
+    IGNORE_ARG(dev);
+}
+
+ssize_t file_preadv(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return preadv(dev->ddriver_fd, iov, iovcnt, offset);
+}
+
+ssize_t file_pwritev(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return pwritev(dev->ddriver_fd, iov, iovcnt, offset);
+}
+
+/* No shared mapping here, so hand out a bounce buffer and write it back on unmap */
+void* file_map(struct ddriver *dev, off_t offset, size_t len) {
+    void *buf = malloc(len);
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (pread(dev->ddriver_fd, buf, len, offset) != (ssize_t)len) {
+        free(buf);
+        errno = EIO;
+        return NULL;
+    }
+    return buf;
+}
+
+int file_unmap(struct ddriver *dev, void *addr, off_t offset, size_t len, int flags) {
+    int ret = 0;
+    if ((flags & DDRIVER_MAP_WRITE) && 
+        pwrite(dev->ddriver_fd, addr, len, offset) != (ssize_t)len) {
+        ret = -EIO;
+    }
+    free(addr);
+    return ret;
+}
+
+/* Last resort when the filesystem under the image can't punch holes */
+int backend_zero_fill(struct ddriver *dev, off_t offset, size_t len) {
+    static char zeros[64 * 1024];
+    struct iovec zero;
+    size_t done, chunk;
+
+    for (done = 0; done < len; done += chunk) {
+        chunk = len - done < sizeof(zeros) ? len - done : sizeof(zeros);
+        zero.iov_base = zeros;
+        zero.iov_len  = chunk;
+        if (dev->ops->pwritev(dev, &zero, 1, offset + done) != (ssize_t)chunk) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+/* Punch a hole so the range reads back as zeros without holding any blocks */
+int file_discard(struct ddriver *dev, off_t offset, size_t len) {
+    if (fallocate(dev->ddriver_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 
+                  offset, len) == 0) {
+        return 0;
+    }
+    if (fallocate(dev->ddriver_fd, FALLOC_FL_ZERO_RANGE, offset, len) == 0) {
+        return 0;
+    }
+    return backend_zero_fill(dev, offset, len);
+}
+
+const struct ddriver_backend_ops file_backend_ops = {
+    .name    = "file",
+    .attach  = file_attach,
+    .detach  = file_detach,
+    .preadv  = file_preadv,
+    .pwritev = file_pwritev,
+    .map     = file_map,
+    .unmap   = file_unmap,
+    .discard = file_discard
+};
+/******************************************************************************
+* SECTION: Mmap Backend
+*******************************************************************************/
+/* The whole image is mapped once, transfers become memcpy without syscalls */
+int mmap_attach(struct ddriver *dev) {
+    void *base = mmap(NULL, dev->layout_size, PROT_READ | PROT_WRITE, 
+                      MAP_SHARED, dev->ddriver_fd, 0);
+    if (base == MAP_FAILED) {
+        user_alert(dev, "mmap %llu bytes failed: %s", 
+                   (unsigned long long)dev->layout_size, strerror(errno));
+        return -errno;
+    }
+    dev->mmap_base = (uint8_t *)base;
+    return 0;
+}
+
+void mmap_detach(struct ddriver *dev) {
+    if (dev->mmap_base != NULL) {
+        msync(dev->mmap_base, dev->layout_size, MS_SYNC);
+        munmap(dev->mmap_base, dev->layout_size);
+        dev->mmap_base = NULL;
+    }
+}
+
+ssize_t mmap_preadv(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    uint8_t *cur = dev->mmap_base + offset;
+    ssize_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, cur, iov[i].iov_len);
+        cur   += iov[i].iov_len;
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+ssize_t mmap_pwritev(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    uint8_t *cur = dev->mmap_base + offset;
+    ssize_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(cur, iov[i].iov_base, iov[i].iov_len);
+        cur   += iov[i].iov_len;
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+void* mmap_map(struct ddriver *dev, off_t offset, size_t len) {
+    IGNORE_ARG(len);
+    return dev->mmap_base + offset;
+}
+
+int mmap_unmap(struct ddriver *dev, void *addr, off_t offset, size_t len, int flags) {
+    IGNORE_ARG(dev);
+    IGNORE_ARG(addr);
+    IGNORE_ARG(offset);
+    IGNORE_ARG(len);
+    IGNORE_ARG(flags);
+    return 0;
+}
+
+const struct ddriver_backend_ops mmap_backend_ops = {
+    .name    = "mmap",
+    .attach  = mmap_attach,
+    .detach  = mmap_detach,
+    .preadv  = mmap_preadv,
+    .pwritev = mmap_pwritev,
+    .map     = mmap_map,
+    .unmap   = mmap_unmap,
+    .discard = file_discard                          /* Shared mapping sees the hole */
+};
+/******************************************************************************
+* SECTION: Direct Backend
+*******************************************************************************/
+/* 
+ * O_DIRECT on the image fd keeps it out of the host page cache. The kernel
+ * wants offsets and lengths aligned to dio_align, which the I/O unit already
+ * guarantees, and buffers aligned to dio_mem_align; callers that can't
+ * promise that go through an aligned bounce buffer.
+ */
+int direct_attach(struct ddriver *dev) {
+    int flags = fcntl(dev->ddriver_fd, F_GETFL);
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+#endif
+
+    dev->dio_align     = 512;
+    dev->dio_mem_align = 4096;
+#ifdef STATX_DIOALIGN
+    if (statx(dev->ddriver_fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align != 0) {
+        dev->dio_align     = stx.stx_dio_offset_align;
+        dev->dio_mem_align = stx.stx_dio_mem_align;
+    }
+#endif
+    if (dev->dio_mem_align < (int)sizeof(void *)) {
+        dev->dio_mem_align = sizeof(void *);            /* posix_memalign minimum */
+    }
+    if (dev->iounit_size % dev->dio_align != 0) {
+        user_alert(dev, "O_DIRECT needs an I/O unit multiple of %d, got %d", 
+                   dev->dio_align, dev->iounit_size);
+        return -EINVAL;
+    }
+    if (flags < 0 || fcntl(dev->ddriver_fd, F_SETFL, flags | O_DIRECT) < 0) {
+        user_alert(dev, "O_DIRECT unsupported here: %s", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+void direct_detach(struct ddriver *dev) {
+    int flags = fcntl(dev->ddriver_fd, F_GETFL);
+    if (flags >= 0) {
+        fcntl(dev->ddriver_fd, F_SETFL, flags & ~O_DIRECT);
+    }
+}
+
+static int direct_iov_aligned(struct ddriver *dev, const struct iovec *iov, int iovcnt) {
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        if ((uintptr_t)iov[i].iov_base % dev->dio_mem_align != 0 ||
+            iov[i].iov_len % dev->dio_align != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *direct_bounce(struct ddriver *dev, size_t len) {
+    void *buf;
+    if (posix_memalign(&buf, dev->dio_mem_align, len) != 0) {
+        return NULL;
+    }
+    return buf;
+}
+
+ssize_t direct_preadv(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    size_t  total = 0, done = 0;
+    ssize_t ret;
+    char   *buf;
+    int i;
+
+    if (direct_iov_aligned(dev, iov, iovcnt)) {
+        return preadv(dev->ddriver_fd, iov, iovcnt, offset);
+    }
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    buf = direct_bounce(dev, total);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ret = pread(dev->ddriver_fd, buf, total, offset);
+    for (i = 0; ret > 0 && i < iovcnt && done < (size_t)ret; i++) {
+        size_t n = iov[i].iov_len < (size_t)ret - done ? iov[i].iov_len : (size_t)ret - done;
+        memcpy(iov[i].iov_base, buf + done, n);
+        done += n;
+    }
+    free(buf);
+    return ret;
+}
+
+ssize_t direct_pwritev(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    size_t  total = 0;
+    ssize_t ret;
+    char   *buf;
+    int i;
+
+    if (direct_iov_aligned(dev, iov, iovcnt)) {
+        return pwritev(dev->ddriver_fd, iov, iovcnt, offset);
+    }
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    buf = direct_bounce(dev, total);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0, total = 0; i < iovcnt; i++) {
+        memcpy(buf + total, iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    ret = pwrite(dev->ddriver_fd, buf, total, offset);
+    free(buf);
+    return ret;
+}
+
+/* Same write-back scheme as the file backend, with a buffer O_DIRECT accepts */
+void* direct_map(struct ddriver *dev, off_t offset, size_t len) {
+    void *buf = direct_bounce(dev, len);
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (pread(dev->ddriver_fd, buf, len, offset) != (ssize_t)len) {
+        free(buf);
+        errno = EIO;
+        return NULL;
+    }
+    return buf;
+}
+
+const struct ddriver_backend_ops direct_backend_ops = {
+    .name    = "direct",
+    .attach  = direct_attach,
+    .detach  = direct_detach,
+    .preadv  = direct_preadv,
+    .pwritev = direct_pwritev,
+    .map     = direct_map,
+    .unmap   = file_unmap,
+    .discard = file_discard
+};
+/******************************************************************************
+* SECTION: Backend Table
+*******************************************************************************/
+const struct ddriver_backend_ops *backends[DDRIVER_BACKEND_NUM] = {
+    [DDRIVER_BACKEND_FILE] = &file_backend_ops,
+    [DDRIVER_BACKEND_MMAP] = &mmap_backend_ops,
+    [DDRIVER_BACKEND_DIRECT] = &direct_backend_ops,
+    [DDRIVER_BACKEND_REMOTE] = &remote_backend_ops,
+};
@@ -0,0 +1,313 @@
+#ifndef _DDRIVER_DEV_H_
+#define _DDRIVER_DEV_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "string.h"
+#include <linux/fs.h>
+#include "ddriver_ctl.h"
+#include "include/ddriver.h"
+#include "stdio.h"
+#include "errno.h"
+#include <pwd.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+
+#define USER_INFO     "INFO: "
+#define USER_ALERT    "WARNING: "
+
+#define USER_PANIC    "PANIC: "
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/   
+#define DEVICE_NAME   "ddriver"
+#define DEVICE_LOG    "_log"                       /* Log lives next to the image */
+#define DEVICE_TRACE  "_trace"                     /* DDRIVER_TRACE=1 puts it here */
+#define DEVICE_MEMBER ".%d"                        /* Composite member images */
+#define DEVICE_SOCK   ".sock"                      /* Default ddriver_server address */
+
+#define user_info(dev, fmt, ...)\
+	do {\
+		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
+        if ((dev) != NULL && (dev)->debugf != NULL)\
+            fprintf((dev)->debugf, USER_INFO " " fmt "\n", ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_alert(dev, fmt, ...)\
+	do {\
+		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
+        if ((dev) != NULL && (dev)->debugf != NULL)\
+            fprintf((dev)->debugf, USER_ALERT " " fmt "\n", ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_panic(fmt, ...)\
+    do {\
+        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+    } while (0)\
+
+#define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
+#define DRIVER_DESC     "A Fake disk driver in user space"
+#define DRIVER_VERSION  "0.1.0"
+
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)             /* Default, DDRIVER_DISK_SZ overrides */
+#define CONFIG_BLOCK_SZ (512)                         /* Default, DDRIVER_IO_SZ overrides */
+#define CONFIG_MAX_IO_SZ (1024 * 1024)
+#define CONFIG_IOV_MAX  (1024)                       /* Same as Linux UIO_MAXIOV */
+#define CONFIG_MAX_DEVS (64)                         /* Open devices per process */
+#define CONFIG_PATH_LEN (4096)
+#define CONFIG_MAX_MAPS (64)                         /* Live ddriver_map regions per device */
+#define CONFIG_AIO_ENTRIES (64)                      /* ddriver_queue_init default */
+#define CONFIG_AIO_ENTRIES_MAX (4096)
+#define CONFIG_AIO_THREADS (4)                       /* Worker pool when io_uring is missing */
+#define CONFIG_AIO_LANES (64)                        /* Cap on modeled parallel lanes */
+#define CONFIG_SCHED_DEADLINE (32)                   /* SCAN: max requests served ahead of one */
+#define CONFIG_WCACHE_LAT (5 * 1000ULL)              /* ns per command absorbed by the cache */
+#define CONFIG_WCACHE_EXTENTS (1024)                 /* Dirty extents before a forced destage */
+#define CONFIG_MEMBERS  (2)                          /* Default, DDRIVER_MEMBERS overrides */
+#define CONFIG_MAX_MEMBERS (16)
+#define CONFIG_CHUNK_SZ (64 * 1024)                  /* Default, DDRIVER_CHUNK_SZ overrides */
+#define CONFIG_REMOTE_TAGS (64)                      /* Requests in flight per connection */
+#define CONFIG_REMOTE_MAX_REQ (CONFIG_MAX_IO_SZ * 64ULL) /* Payload bytes per read/write request */
+#define CONFIG_SERVER_WORKERS (4)                    /* ddriver_server threads per connection */
+/******************************************************************************
+* SECTION: Macro Functions 
+*******************************************************************************/
+#define IGNORE_ARG(arg)         ((void)arg)
+#define IS_ADDR_ALIGN(dev, addr)    ((addr) % (dev)->iounit_size == 0)
+#define ADDR_ROUND_UP(dev, addr)    (((addr) / (dev)->iounit_size) * (dev)->iounit_size)
+
+/* Counters are bumped after the copy, outside model_lock, from any thread */
+#define ATOMIC_ADD(ptr, n)      __atomic_fetch_add((ptr), (n), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(ptr)        __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define INC_READCNT(dev)        ATOMIC_ADD(&(dev)->read_cnt, 1)
+#define INC_WRITECNT(dev)       ATOMIC_ADD(&(dev)->write_cnt, 1)
+#define INC_SEEKCNT(dev)        ATOMIC_ADD(&(dev)->seek_cnt, 1)
+
+#define NSEC_PER_MSEC           (1000000ULL)
+#define NSEC_PER_USEC           (1000ULL)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/* Trace file: one header, then fixed-size records in call order */
+#define DDRIVER_TRACE_MAGIC     "DDTRACE1"
+#define DDRIVER_TRACE_VERSION   3
+#define DDRIVER_TRACE_F_QUEUED  0x1                  /* Read/write went through ddriver_submit */
+
+enum ddriver_trace_op {
+    DDRIVER_TRACE_SEEK,                              /* offset: new head */
+    DDRIVER_TRACE_READ,
+    DDRIVER_TRACE_WRITE,
+    DDRIVER_TRACE_DISCARD,
+    DDRIVER_TRACE_IOCTL,                             /* aux: cmd, offset: argument if any */
+    DDRIVER_TRACE_SUBMIT                             /* Closes a batch of queued requests */
+};
+
+struct ddriver_trace_hdr
+{
+    char     magic[8];
+    uint32_t version;
+    int32_t  io_size;
+    uint64_t disk_size;
+    int32_t  profile;
+    int32_t  sched;
+    uint64_t wcache_size;
+    int32_t  layout;
+    int32_t  members;
+    int32_t  chunk_size;
+    int32_t  reserved;
+};
+
+struct ddriver_trace_rec
+{
+    uint64_t ts_ns;                                  /* Wall time since the trace began */
+    uint64_t offset;
+    uint64_t size;
+    uint32_t op;                                     /* DDRIVER_TRACE_* */
+    uint32_t aux;
+};
+
+/*
+ * Remote protocol: a stream of requests, each answered by one response with
+ * the same tag. A client keeps many requests in flight on one connection and
+ * the server may answer them in any order. Write payload follows its
+ * request, read payload follows its response. Host byte order, both ends
+ * are expected to be the same build.
+ */
+#define DDRIVER_NET_MAGIC       0x314e4444           /* "DDN1" */
+
+enum ddriver_net_op {
+    DDRIVER_NET_HELLO,                               /* len: bytes the image must hold */
+    DDRIVER_NET_READ,
+    DDRIVER_NET_WRITE,
+    DDRIVER_NET_DISCARD
+};
+
+struct ddriver_net_req
+{
+    uint32_t magic;
+    uint32_t op;                                     /* DDRIVER_NET_* */
+    uint64_t tag;
+    uint64_t offset;
+    uint64_t len;
+};
+
+struct ddriver_net_rsp
+{
+    uint32_t magic;
+    int32_t  res;                                    /* 0 or -errno */
+    uint64_t tag;
+    uint64_t len;                                    /* Payload bytes that follow */
+};
+
+struct ddriver;
+struct ddriver_queue;                                /* ddriver_aio.c */
+struct raid_worker;                                  /* ddriver_raid.c */
+struct ddriver_remote;                               /* ddriver_remote.c */
+
+/* Where the bytes of a device actually live */
+struct ddriver_backend_ops
+{
+    const char *name;
+    int     (*attach)(struct ddriver *dev);          /* After geometry is known */
+    void    (*detach)(struct ddriver *dev);
+    ssize_t (*preadv)(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset);
+    ssize_t (*pwritev)(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset);
+    void*   (*map)(struct ddriver *dev, off_t offset, size_t len);
+    int     (*unmap)(struct ddriver *dev, void *addr, off_t offset, size_t len, int flags);
+    int     (*discard)(struct ddriver *dev, off_t offset, size_t len); /* Reads back as zeros */
+};
+
+struct ddriver_extent
+{
+    off_t  offset;
+    size_t len;
+};
+
+struct ddriver_map_region
+{
+    void  *addr;
+    off_t  offset;
+    size_t len;
+    int    flags;                                    /* DDRIVER_MAP_* */
+};
+
+struct ddriver
+{
+    int  ddriver_fd;                                 /* Disk ddriver_fd */
+    int  read_cnt;
+    int  write_cnt;
+    int  seek_cnt;
+    int  profile;                                    /* DDRIVER_PROFILE_* */
+    uint64_t read_lat;                               /* ns per read command */
+    uint64_t write_lat;                              /* ns per write command */
+    uint64_t seek_lat;                               /* ns per track of head travel */
+    uint64_t xfer_lat;                               /* ns per sector on one channel */
+    int  track_num;                                  /* 0 means no seek penalty */
+    int  channels;                                   /* Internal parallel channels */
+    int  queue_depth;                                /* Max requests in flight */
+    int  major_num;
+    uint64_t layout_size;                            /* Device bytes, may exceed 2 GiB */
+    int  iounit_size;
+    off_t head;                                      /* Emulated head position */
+    off_t cursor;                                    /* Where ddriver_read/write go next */
+    int  sim_time;                                   /* Advance vclock only, never sleep */
+    uint64_t vclock_ns;                              /* Modeled device time */
+    FILE *debugf;                                    /* Per-device log */
+    int  backend;                                    /* DDRIVER_BACKEND_* */
+    const struct ddriver_backend_ops *ops;
+    uint8_t *mmap_base;                              /* DDRIVER_BACKEND_MMAP only */
+    int  dio_align;                                  /* DDRIVER_BACKEND_DIRECT only */
+    int  dio_mem_align;
+    char *remote_addr;                               /* DDRIVER_BACKEND_REMOTE only */
+    struct ddriver_remote *remote;
+    struct ddriver_map_region maps[CONFIG_MAX_MAPS];
+    int  map_cnt;
+    struct ddriver_queue *queue;                     /* NULL until ddriver_queue_init */
+    struct ddriver_sched_state sched;                /* Queue scheduler policy and stats */
+    struct ddriver_state_v2 stat;                    /* 64-bit telemetry */
+    struct ddriver_wcache_state wcache;              /* size 0: write cache off */
+    struct ddriver_extent *wcache_ext;               /* Dirty extents, unsorted */
+    int  wcache_ext_cnt;
+    FILE *tracef;                                    /* NULL unless DDRIVER_TRACE is set */
+    uint64_t trace_t0;
+    int  layout;                                     /* DDRIVER_LAYOUT_* */
+    int  chunk_size;                                 /* Stripe unit */
+    int  member_cnt;                                 /* 0 unless composite */
+    struct ddriver *members[CONFIG_MAX_MEMBERS];
+    struct raid_worker *raid_workers;                /* One per member, NULL unless composite */
+    /*
+     * Transfers hold geom_lock shared for their whole life and model_lock
+     * only while they move the head and the clock, so data copies from
+     * different threads overlap. Geometry changes and reset hold geom_lock
+     * alone. model_lock is recursive so ioctls can nest model updates.
+     */
+    pthread_rwlock_t geom_lock;
+    pthread_mutex_t  model_lock;                     /* head, vclock, maps, wcache, sched */
+};
+/******************************************************************************
+* SECTION: Shared Declarations
+*******************************************************************************/
+extern const struct ddriver_backend_ops file_backend_ops;
+extern const struct ddriver_backend_ops mmap_backend_ops;
+extern const struct ddriver_backend_ops direct_backend_ops;
+extern const struct ddriver_backend_ops raid_backend_ops;
+extern const struct ddriver_backend_ops remote_backend_ops;
+extern const struct ddriver_backend_ops *backends[DDRIVER_BACKEND_NUM];
+extern const char *sched_names[DDRIVER_SCHED_NUM];
+extern const char *layout_names[DDRIVER_LAYOUT_NUM];
+extern const struct ddriver disk_default;
+
+struct ddriver *ddriver_get(int fd);
+int      check_valid_iov(struct ddriver *dev, const struct iovec *iov, int iovcnt, size_t *total);
+int      check_range(struct ddriver *dev, off_t offset, size_t size);
+uint64_t model_rotate(struct ddriver *dev, off_t start, off_t end);
+uint64_t model_transfer(struct ddriver *dev, uint64_t cmd_lat, size_t size);
+uint64_t model_access(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t *seek_ns);
+void     emulate_sleep(struct ddriver *dev, uint64_t ns);
+int      emulate_delay(struct ddriver *dev, uint64_t ns);
+void     ddriver_lock_init(struct ddriver *dev);
+void     ddriver_lock_destroy(struct ddriver *dev);
+int      apply_geometry(struct ddriver *dev, uint64_t disk_size, int io_size);
+int      apply_profile(struct ddriver *dev, int id);
+void     account_geometry(struct ddriver *dev);
+void     account_reset(struct ddriver *dev);
+void     account_seek(struct ddriver *dev, off_t from, off_t to);
+void     account_io(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t lat_ns);
+void     account_snapshot(struct ddriver *dev, struct ddriver_state_v2 *stat);
+void     trace_record(struct ddriver *dev, int op, uint64_t offset, uint64_t size, uint32_t aux);
+int      lookup_profile(const char *name);
+
+int      wcache_resize(struct ddriver *dev, uint64_t size, uint64_t *cost);
+uint64_t wcache_destage(struct ddriver *dev);
+int      wcache_write(struct ddriver *dev, off_t offset, size_t size, uint64_t *cost);
+int      wcache_read(struct ddriver *dev, off_t offset, size_t size, uint64_t *cost);
+void     wcache_drop(struct ddriver *dev);
+void     wcache_discard(struct ddriver *dev, off_t offset, size_t len);
+int      lookup_backend(const char *name);
+int      remote_sockaddr(const char *addr, struct sockaddr_storage *ss, socklen_t *len);
+uint64_t parse_size(const char *str);
+
+int      ddriver_queue_busy(struct ddriver *dev);
+int      ddriver_queue_reap(struct ddriver *dev, struct ddriver_cqe *cqes, int max, int min_complete);
+void     ddriver_queue_destroy(struct ddriver *dev);
+
+int      lookup_layout(const char *name);
+int      raid_open(struct ddriver *dev, const char *path, int members, int backend,
+                   uint64_t *disk_size);
+void     raid_close(struct ddriver *dev);
+uint64_t raid_access(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t *seek_ns);
+
+int      lookup_sched(const char *name);
+void     sched_order(int policy, off_t head, const off_t *offs, const size_t *sizes,
+                     unsigned *order, unsigned n);
+
+#endif /* _DDRIVER_DEV_H_ */
@@ -0,0 +1,573 @@
+#include "ddriver_dev.h"
+
+/******************************************************************************
+* SECTION: Composite devices
+*
+* A composite device owns no image of its own. Its bytes live on member
+* devices, each a plain struct ddriver with its own image (<path>.<i>),
+* backend, head and counters, that is never handed out as a handle. The
+* composite keeps the logical cursor, clock, queue, cache and telemetry;
+* every media command is split across the members, each member is charged
+* for its share on its own head, and the members work side by side, so the
+* command costs as much as the slowest member. The data moves the same way:
+* every member has a worker thread for the device's lifetime, and the
+* caller's thread moves the first share while the workers move the rest.
+* Member heads and clocks only move under the composite's model_lock.
+*
+* A stripe deals chunk_size units out to the members in turn. A mirror
+* writes every member and reads one of them.
+*******************************************************************************/
+const char *layout_names[DDRIVER_LAYOUT_NUM] = {
+    [DDRIVER_LAYOUT_SINGLE] = "single",
+    [DDRIVER_LAYOUT_STRIPE] = "stripe",
+    [DDRIVER_LAYOUT_MIRROR] = "mirror",
+};
+
+int lookup_layout(const char *name) {
+    int i;
+    for (i = 0; i < DDRIVER_LAYOUT_NUM; i++) {
+        if (strcmp(layout_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+/* Bytes each member holds for a composite of disk_size */
+static uint64_t raid_member_size(struct ddriver *dev, uint64_t disk_size) {
+    uint64_t row = (uint64_t)dev->chunk_size * dev->member_cnt;
+    if (dev->layout == DDRIVER_LAYOUT_MIRROR) {
+        return disk_size;
+    }
+    return (disk_size + row - 1) / row * dev->chunk_size;
+}
+
+/*
+ * The part of [offset, offset + size) that lands on member m. Consecutive
+ * stripe units of one member sit back to back on it, so the share is always
+ * a single contiguous member range.
+ */
+static int raid_share(struct ddriver *dev, int m, off_t offset, size_t size,
+                      off_t *moff, size_t *mlen) {
+    uint64_t c = dev->chunk_size, n = dev->member_cnt;
+    uint64_t u0 = offset / c, u1 = (offset + size - 1) / c;
+    uint64_t uf = u0 + (m + n - u0 % n) % n;
+    uint64_t ul = u1 - (u1 % n + n - m) % n;
+    uint64_t first, last;
+
+    if (dev->layout == DDRIVER_LAYOUT_MIRROR) {
+        *moff = offset;
+        *mlen = size;
+        return size != 0;
+    }
+    if (size == 0 || uf > u1) {
+        return 0;
+    }
+    first = uf * c > (uint64_t)offset ? uf * c : (uint64_t)offset;
+    last  = (ul + 1) * c - 1 < offset + size - 1 ? (ul + 1) * c - 1 : offset + size - 1;
+    *moff = (uf / n) * c + (first - uf * c);
+    *mlen = (ul / n) * c + (last - ul * c) + 1 - *moff;
+    return 1;
+}
+
+/* Append the slice [from, from + len) of the caller's iovec to out */
+static int iov_slice(const struct iovec *iov, int iovcnt, size_t from, size_t len,
+                     struct iovec *out, int cnt) {
+    size_t skip;
+    int i;
+
+    for (i = 0; i < iovcnt && len > 0; i++) {
+        if (from >= iov[i].iov_len) {
+            from -= iov[i].iov_len;
+            continue;
+        }
+        skip = iov[i].iov_len - from < len ? iov[i].iov_len - from : len;
+        if (cnt > 0 && (char *)out[cnt - 1].iov_base + out[cnt - 1].iov_len ==
+                       (char *)iov[i].iov_base + from) {
+            out[cnt - 1].iov_len += skip;       /* Continues the previous entry */
+        }
+        else {
+            out[cnt].iov_base = (char *)iov[i].iov_base + from;
+            out[cnt].iov_len  = skip;
+            cnt++;
+        }
+        len -= skip;
+        from = 0;
+    }
+    return cnt;
+}
+
+/* Member m's share of a transfer, in member order, as one iovec */
+static int raid_member_iov(struct ddriver *dev, int m, const struct iovec *iov, int iovcnt,
+                           off_t offset, size_t size, struct iovec *out) {
+    uint64_t c = dev->chunk_size, n = dev->member_cnt;
+    uint64_t u, u1 = (offset + size - 1) / c;
+    uint64_t from, to;
+    int cnt = 0;
+
+    if (dev->layout == DDRIVER_LAYOUT_MIRROR) {
+        return iov_slice(iov, iovcnt, 0, size, out, 0);
+    }
+    for (u = offset / c; u <= u1; u++) {
+        if (u % n != (uint64_t)m)
+            continue;
+        from = u * c > (uint64_t)offset ? u * c : (uint64_t)offset;
+        to   = (u + 1) * c < offset + size ? (u + 1) * c : offset + size;
+        cnt  = iov_slice(iov, iovcnt, from - offset, to - from, out, cnt);
+    }
+    return cnt;
+}
+
+/* Shares of one transfer still running on member workers */
+struct raid_batch
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  done_cond;
+    int             left;
+};
+
+/* One member's share of a composite transfer */
+struct raid_job
+{
+    struct ddriver    *member;
+    int                op;
+    struct iovec      *iov;
+    int                iovcnt;
+    off_t              offset;
+    size_t             len;
+    ssize_t            ret;
+    int                err;             /* errno of a failed transfer */
+    struct raid_batch *batch;
+    struct raid_job   *next;
+};
+
+/* Each member has one thread for the lifetime of the device, fed a job at a time */
+struct raid_worker
+{
+    pthread_t        tid;
+    int              running;           /* 0: the member's shares run inline */
+    int              stop;
+    pthread_mutex_t  lock;
+    pthread_cond_t   work_cond;
+    struct raid_job *work_head;
+    struct raid_job *work_tail;
+};
+
+/* A stripe share can have more entries than one preadv/pwritev takes, go in batches */
+static void raid_job_run(struct raid_job *job) {
+    struct ddriver  *member = job->member;
+    struct iovec    *iov    = job->iov;
+    off_t   offset = job->offset;
+    size_t  part;
+    ssize_t ret;
+    int i, cnt, left = job->iovcnt;
+
+    job->ret = job->len;
+    while (left > 0) {
+        cnt = left < CONFIG_IOV_MAX ? left : CONFIG_IOV_MAX;
+        for (i = 0, part = 0; i < cnt; i++) {
+            part += iov[i].iov_len;
+        }
+        ret = job->op == DDRIVER_OP_WRITE ? member->ops->pwritev(member, iov, cnt, offset)
+                                          : member->ops->preadv(member, iov, cnt, offset);
+        if (ret != (ssize_t)part) {
+            job->ret = ret < 0 ? -1 : 0;
+            job->err = ret < 0 ? errno : EIO;
+            break;
+        }
+        iov    += cnt;
+        left   -= cnt;
+        offset += part;
+    }
+}
+
+static void *raid_worker_main(void *arg) {
+    struct raid_worker *w = arg;
+    struct raid_job    *job;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->stop && w->work_head == NULL) {
+            pthread_cond_wait(&w->work_cond, &w->lock);
+        }
+        if (w->work_head == NULL) {
+            break;
+        }
+        job = w->work_head;
+        w->work_head = job->next;
+        if (w->work_head == NULL) {
+            w->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        raid_job_run(job);
+
+        pthread_mutex_lock(&job->batch->lock);
+        if (--job->batch->left == 0) {
+            pthread_cond_signal(&job->batch->done_cond);
+        }
+        pthread_mutex_unlock(&job->batch->lock);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void raid_worker_push(struct raid_worker *w, struct raid_job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->work_tail != NULL)
+        w->work_tail->next = job;
+    else
+        w->work_head = job;
+    w->work_tail = job;
+    pthread_cond_signal(&w->work_cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* A member whose thread can't start still works, its shares just run inline */
+static int raid_workers_start(struct ddriver *dev) {
+    struct raid_worker *w;
+    int m;
+
+    dev->raid_workers = calloc(dev->member_cnt, sizeof(struct raid_worker));
+    if (dev->raid_workers == NULL) {
+        return -ENOMEM;
+    }
+    for (m = 0; m < dev->member_cnt; m++) {
+        w = &dev->raid_workers[m];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->work_cond, NULL);
+        w->running = pthread_create(&w->tid, NULL, raid_worker_main, w) == 0;
+    }
+    return 0;
+}
+
+static void raid_workers_stop(struct ddriver *dev) {
+    struct raid_worker *w;
+    int m;
+
+    if (dev->raid_workers == NULL) {
+        return;
+    }
+    for (m = 0; m < dev->member_cnt; m++) {
+        w = &dev->raid_workers[m];
+        if (w->running) {
+            pthread_mutex_lock(&w->lock);
+            w->stop = 1;
+            pthread_cond_signal(&w->work_cond);
+            pthread_mutex_unlock(&w->lock);
+            pthread_join(w->tid, NULL);
+        }
+        pthread_cond_destroy(&w->work_cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+    free(dev->raid_workers);
+    dev->raid_workers = NULL;
+}
+
+/* Members have their own images and fds, so their shares run side by side */
+static ssize_t raid_rw(struct ddriver *dev, int op, const struct iovec *iov, int iovcnt,
+                       off_t offset) {
+    struct raid_job jobs[CONFIG_MAX_MEMBERS];
+    struct raid_worker *workers[CONFIG_MAX_MEMBERS];
+    struct raid_batch batch;
+    struct iovec *sub;
+    size_t  total = 0, per, mlen;
+    off_t   moff;
+    int i, m, cnt = 0, queued = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    /* Every caller entry may cross every stripe unit boundary once */
+    per = iovcnt + total / dev->chunk_size + 2;
+    sub = malloc(per * dev->member_cnt * sizeof(struct iovec));
+    if (sub == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (m = 0; m < dev->member_cnt; m++) {
+        if (!raid_share(dev, m, offset, total, &moff, &mlen))
+            continue;
+        /* Mirrors hold the same bytes, any copy will do for the data */
+        if (dev->layout == DDRIVER_LAYOUT_MIRROR && op == DDRIVER_OP_READ && m > 0)
+            break;
+        jobs[cnt].member = dev->members[m];
+        jobs[cnt].op     = op;
+        jobs[cnt].iov    = sub + per * m;
+        jobs[cnt].iovcnt = raid_member_iov(dev, m, iov, iovcnt, offset, total, jobs[cnt].iov);
+        jobs[cnt].offset = moff;
+        jobs[cnt].len    = mlen;
+        jobs[cnt].err    = 0;
+        jobs[cnt].batch  = &batch;
+        workers[cnt]     = dev->raid_workers != NULL && dev->raid_workers[m].running
+                         ? &dev->raid_workers[m] : NULL;
+        cnt++;
+    }
+
+    /* The caller's thread takes the first share; a member without a thread runs inline */
+    for (i = 1; i < cnt; i++) {
+        if (workers[i] != NULL)
+            queued++;
+    }
+    batch.left = queued;
+    if (queued > 0) {
+        pthread_mutex_init(&batch.lock, NULL);
+        pthread_cond_init(&batch.done_cond, NULL);
+        for (i = 1; i < cnt; i++) {
+            if (workers[i] != NULL)
+                raid_worker_push(workers[i], &jobs[i]);
+        }
+    }
+    for (i = 0; i < cnt; i++) {
+        if (i == 0 || workers[i] == NULL)
+            raid_job_run(&jobs[i]);
+    }
+    if (queued > 0) {
+        pthread_mutex_lock(&batch.lock);
+        while (batch.left > 0) {
+            pthread_cond_wait(&batch.done_cond, &batch.lock);
+        }
+        pthread_mutex_unlock(&batch.lock);
+        pthread_cond_destroy(&batch.done_cond);
+        pthread_mutex_destroy(&batch.lock);
+    }
+    free(sub);
+    for (i = 0; i < cnt; i++) {
+        if (jobs[i].ret != (ssize_t)jobs[i].len) {
+            errno = jobs[i].err;
+            return jobs[i].ret;
+        }
+    }
+    return total;
+}
+
+/*
+ * The mirror whose head is the shortest seek away. Without seek cost (flash
+ * profiles) every mirror ties, and the one that has served the fewest reads
+ * takes it, which spreads a queued batch evenly over the copies.
+ */
+static int raid_pick_read(struct ddriver *dev, off_t offset) {
+    struct ddriver *member;
+    uint64_t seek, best_seek = UINT64_MAX;
+    int m, best = 0;
+
+    for (m = 0; m < dev->member_cnt; m++) {
+        member = dev->members[m];
+        seek   = model_rotate(member, member->head, offset);
+        if (seek < best_seek ||
+            (seek == best_seek && ATOMIC_LOAD(&member->stat.read_cnt) <
+                                  ATOMIC_LOAD(&dev->members[best]->stat.read_cnt))) {
+            best_seek = seek;
+            best      = m;
+        }
+    }
+    return best;
+}
+
+static uint64_t raid_charge(struct ddriver *dev, int m, int op, off_t offset, size_t size,
+                            uint64_t *seek_ns) {
+    struct ddriver *member = dev->members[m];
+    uint64_t cost = model_access(member, op, offset, size, seek_ns);
+
+    account_io(member, op, offset, size, cost);
+    return cost;
+}
+
+/**
+ * @brief 一条命令在各成员上的模拟耗时，各成员并行，取最慢者
+ *
+ * @param dev 组合设备
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset 逻辑位置
+ * @param size 大小
+ * @param seek_ns 各成员寻道耗时之和，可为NULL
+ * @return uint64_t 耗时(ns)
+ */
+uint64_t raid_access(struct ddriver *dev, int op, off_t offset, size_t size, uint64_t *seek_ns) {
+    uint64_t cost, seek, worst = 0, seeks = 0;
+    size_t   mlen;
+    off_t    moff;
+    int m;
+
+    if (dev->layout == DDRIVER_LAYOUT_MIRROR && op == DDRIVER_OP_READ) {
+        worst = raid_charge(dev, raid_pick_read(dev, offset), op, offset, size, &seeks);
+    }
+    else {
+        for (m = 0; m < dev->member_cnt; m++) {
+            if (!raid_share(dev, m, offset, size, &moff, &mlen))
+                continue;
+            cost   = raid_charge(dev, m, op, moff, mlen, &seek);
+            seeks += seek;
+            if (cost > worst)
+                worst = cost;
+        }
+    }
+    if (seek_ns != NULL) {
+        *seek_ns = seeks;
+    }
+    return worst;
+}
+
+/* Members follow the composite's geometry, each holding its share */
+int raid_attach(struct ddriver *dev) {
+    uint64_t size;
+    int m, ret;
+
+    if (dev->layout == DDRIVER_LAYOUT_STRIPE && dev->chunk_size % dev->iounit_size != 0) {
+        user_alert(dev, "chunk size %d must be a multiple of io size %d",
+                   dev->chunk_size, dev->iounit_size);
+        return -EINVAL;
+    }
+    size = raid_member_size(dev, dev->layout_size);
+    for (m = 0; m < dev->member_cnt; m++) {
+        ret = apply_geometry(dev->members[m], size, dev->iounit_size);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+void raid_detach(struct ddriver *dev) {
+    int m;
+    for (m = 0; m < dev->member_cnt; m++) {
+        dev->members[m]->ops->detach(dev->members[m]);
+    }
+}
+
+ssize_t raid_preadv(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return raid_rw(dev, DDRIVER_OP_READ, iov, iovcnt, offset);
+}
+
+ssize_t raid_pwritev(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return raid_rw(dev, DDRIVER_OP_WRITE, iov, iovcnt, offset);
+}
+
+/* The stripe is never contiguous in memory, so maps are always bounce buffers */
+void* raid_map(struct ddriver *dev, off_t offset, size_t len) {
+    struct iovec iov = { .iov_base = malloc(len), .iov_len = len };
+    if (iov.iov_base == NULL) {
+        return NULL;
+    }
+    if (raid_rw(dev, DDRIVER_OP_READ, &iov, 1, offset) != (ssize_t)len) {
+        free(iov.iov_base);
+        errno = EIO;
+        return NULL;
+    }
+    return iov.iov_base;
+}
+
+int raid_unmap(struct ddriver *dev, void *addr, off_t offset, size_t len, int flags) {
+    struct iovec iov = { .iov_base = addr, .iov_len = len };
+    int ret = 0;
+    if ((flags & DDRIVER_MAP_WRITE) &&
+        raid_rw(dev, DDRIVER_OP_WRITE, &iov, 1, offset) != (ssize_t)len) {
+        ret = -EIO;
+    }
+    free(addr);
+    return ret;
+}
+
+int raid_discard(struct ddriver *dev, off_t offset, size_t len) {
+    struct ddriver *member;
+    size_t mlen;
+    off_t  moff;
+    int m, ret;
+
+    for (m = 0; m < dev->member_cnt; m++) {
+        if (!raid_share(dev, m, offset, len, &moff, &mlen))
+            continue;
+        member = dev->members[m];
+        ret = member->ops->discard(member, moff, mlen);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+const struct ddriver_backend_ops raid_backend_ops = {
+    .name    = "raid",
+    .attach  = raid_attach,
+    .detach  = raid_detach,
+    .preadv  = raid_preadv,
+    .pwritev = raid_pwritev,
+    .map     = raid_map,
+    .unmap   = raid_unmap,
+    .discard = raid_discard
+};
+
+/**
+ * @brief 打开组合设备的成员镜像<path>.<i>，几何参数在之后的apply_geometry中确定
+ *
+ * @param dev 组合设备
+ * @param path 组合设备路径
+ * @param members 成员个数
+ * @param backend 成员使用的后端
+ * @param disk_size 为0时按已有成员镜像推算逻辑大小
+ * @return int 0成功，否则失败
+ */
+int raid_open(struct ddriver *dev, const char *path, int members, int backend,
+              uint64_t *disk_size) {
+    char member_path[CONFIG_PATH_LEN + sizeof(DEVICE_MEMBER) + 8];
+    struct ddriver *member;
+    struct stat st;
+    int m, fd;
+
+    if (backend == DDRIVER_BACKEND_REMOTE) {
+        user_panic("composite members must be local images");
+        return -EINVAL;
+    }
+    if (members < 2 || members > CONFIG_MAX_MEMBERS) {
+        user_panic("a composite device needs 2 to %d members, got %d",
+                   CONFIG_MAX_MEMBERS, members);
+        return -EINVAL;
+    }
+    for (m = 0; m < members; m++) {
+        snprintf(member_path, sizeof(member_path), "%s" DEVICE_MEMBER, path, m);
+        fd = open(member_path, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            user_panic("can't open member [%s]: %s", member_path, strerror(errno));
+            raid_close(dev);
+            return -errno;
+        }
+        member = malloc(sizeof(struct ddriver));
+        if (member == NULL) {
+            close(fd);
+            raid_close(dev);
+            return -ENOMEM;
+        }
+        *member = disk_default;
+        ddriver_lock_init(member);
+        member->ddriver_fd = fd;
+        member->backend    = backend;
+        member->ops        = backends[backend];
+        dev->members[dev->member_cnt++] = member;
+    }
+    if (raid_workers_start(dev) < 0) {
+        raid_close(dev);
+        return -ENOMEM;
+    }
+
+    if (*disk_size == 0 && fstat(dev->members[0]->ddriver_fd, &st) == 0) {
+        *disk_size = dev->layout == DDRIVER_LAYOUT_MIRROR ? (uint64_t)st.st_size
+                                                          : (uint64_t)st.st_size * members;
+    }
+    dev->ops = &raid_backend_ops;
+    return 0;
+}
+
+void raid_close(struct ddriver *dev) {
+    struct ddriver *member;
+
+    raid_workers_stop(dev);
+    while (dev->member_cnt > 0) {
+        member = dev->members[--dev->member_cnt];
+        member->ops->detach(member);
+        close(member->ddriver_fd);
+        ddriver_lock_destroy(member);
+        free(member);
+    }
+}
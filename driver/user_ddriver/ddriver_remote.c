@@ -0,0 +1,408 @@
+#include "ddriver_dev.h"
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+
+/******************************************************************************
+* SECTION: Remote Backend
+*
+* The bytes live on a ddriver_server; this side keeps the whole device model.
+* Every caller takes a free tag, sends its request and sleeps on the tag. A
+* receiver thread reads responses in whatever order the server sends them and
+* wakes the owner, copying read payload straight into the owner's iovec. The
+* queue's worker threads therefore keep several requests in flight on one
+* connection.
+*******************************************************************************/
+struct remote_tag
+{
+    int           busy;
+    int           done;
+    ssize_t       res;
+    const struct iovec *iov;                         /* Read destination */
+    int           iovcnt;
+    pthread_cond_t cond;
+};
+
+struct ddriver_remote
+{
+    int             sock;
+    int             dead;                            /* Connection lost, fail everything */
+    pthread_t       rx;
+    pthread_mutex_t lock;                            /* Tags */
+    pthread_mutex_t send_lock;                       /* One request on the wire at a time */
+    pthread_cond_t  tag_cond;                        /* A tag came free */
+    struct remote_tag tags[CONFIG_REMOTE_TAGS];
+};
+
+/**
+ * @brief 解析unix:<path>或tcp:<host>:<port>形式的地址
+ *
+ * @param addr 地址
+ * @param ss 输出
+ * @param len 输出地址长度
+ * @return int 0成功，否则失败
+ */
+int remote_sockaddr(const char *addr, struct sockaddr_storage *ss, socklen_t *len) {
+    struct sockaddr_un *un = (struct sockaddr_un *)ss;
+    struct addrinfo hints, *res;
+    char host[256];
+    const char *port;
+
+    memset(ss, 0, sizeof(*ss));
+    if (strncmp(addr, "unix:", 5) == 0) {
+        if (strlen(addr + 5) >= sizeof(un->sun_path)) {
+            return -ENAMETOOLONG;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, addr + 5);
+        *len = sizeof(struct sockaddr_un);
+        return 0;
+    }
+    if (strncmp(addr, "tcp:", 4) == 0 && (port = strrchr(addr + 4, ':')) != NULL &&
+        port - (addr + 4) < (long)sizeof(host)) {
+        memcpy(host, addr + 4, port - (addr + 4));
+        host[port - (addr + 4)] = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port + 1, &hints, &res) != 0) {
+            return -EHOSTUNREACH;
+        }
+        memcpy(ss, res->ai_addr, res->ai_addrlen);
+        *len = res->ai_addrlen;
+        freeaddrinfo(res);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/* sendmsg until everything is out, iov is consumed in place */
+static int remote_send(int sock, struct iovec *iov, int iovcnt) {
+    struct msghdr msg;
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iovcnt > CONFIG_IOV_MAX ? CONFIG_IOV_MAX : iovcnt;
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -EPIPE;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int remote_recv(int sock, void *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = recv(sock, buf, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -EPIPE;
+        buf  = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Spread len payload bytes over the owner's iovec */
+static int remote_recv_iov(int sock, const struct iovec *iov, int iovcnt, size_t len) {
+    size_t chunk;
+    int i, ret;
+
+    for (i = 0; i < iovcnt && len > 0; i++) {
+        chunk = iov[i].iov_len < len ? iov[i].iov_len : len;
+        ret = remote_recv(sock, iov[i].iov_base, chunk);
+        if (ret < 0)
+            return ret;
+        len -= chunk;
+    }
+    return len == 0 ? 0 : -EPROTO;
+}
+
+static void *remote_receiver(void *arg) {
+    struct ddriver_remote *r = arg;
+    struct ddriver_net_rsp rsp;
+    struct remote_tag *t;
+    int i;
+
+    while (remote_recv(r->sock, &rsp, sizeof(rsp)) == 0) {
+        if (rsp.magic != DDRIVER_NET_MAGIC || rsp.tag >= CONFIG_REMOTE_TAGS ||
+            !r->tags[rsp.tag].busy) {
+            break;
+        }
+        t = &r->tags[rsp.tag];
+        if (rsp.len > 0 && remote_recv_iov(r->sock, t->iov, t->iovcnt, rsp.len) < 0) {
+            break;
+        }
+        pthread_mutex_lock(&r->lock);
+        t->res  = rsp.res < 0 ? rsp.res : (ssize_t)rsp.len;
+        t->done = 1;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->dead = 1;
+    for (i = 0; i < CONFIG_REMOTE_TAGS; i++) {
+        pthread_cond_signal(&r->tags[i].cond);
+    }
+    pthread_cond_broadcast(&r->tag_cond);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+/* One round trip; returns payload bytes for reads, 0 for the rest, or -errno */
+static ssize_t remote_call(struct ddriver *dev, int op, const struct iovec *iov, int iovcnt,
+                           uint64_t offset, uint64_t len) {
+    struct ddriver_remote *r = dev->remote;
+    struct ddriver_net_req req;
+    struct iovec *out;
+    ssize_t res;
+    int i, tag = -1;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->dead) {
+        for (i = 0; i < CONFIG_REMOTE_TAGS && tag < 0; i++) {
+            if (!r->tags[i].busy)
+                tag = i;
+        }
+        if (tag >= 0)
+            break;
+        pthread_cond_wait(&r->tag_cond, &r->lock);
+    }
+    if (r->dead) {
+        pthread_mutex_unlock(&r->lock);
+        return -ECONNRESET;
+    }
+    r->tags[tag].busy   = 1;
+    r->tags[tag].done   = 0;
+    r->tags[tag].iov    = iov;
+    r->tags[tag].iovcnt = op == DDRIVER_NET_READ ? iovcnt : 0;
+    pthread_mutex_unlock(&r->lock);
+
+    req.magic  = DDRIVER_NET_MAGIC;
+    req.op     = op;
+    req.tag    = tag;
+    req.offset = offset;
+    req.len    = len;
+    out = malloc((iovcnt + 1) * sizeof(struct iovec));
+    if (out == NULL) {
+        res = -ENOMEM;
+        goto release;
+    }
+    out[0].iov_base = &req;
+    out[0].iov_len  = sizeof(req);
+    for (i = 0; op == DDRIVER_NET_WRITE && i < iovcnt; i++) {
+        out[i + 1] = iov[i];
+    }
+    pthread_mutex_lock(&r->send_lock);
+    res = remote_send(r->sock, out, op == DDRIVER_NET_WRITE ? iovcnt + 1 : 1);
+    pthread_mutex_unlock(&r->send_lock);
+    free(out);
+    if (res < 0) {
+        /* The receiver sees the same broken stream and fails the others */
+        goto release;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->tags[tag].done && !r->dead) {
+        pthread_cond_wait(&r->tags[tag].cond, &r->lock);
+    }
+    res = r->tags[tag].done ? r->tags[tag].res : -ECONNRESET;
+    pthread_mutex_unlock(&r->lock);
+
+release:
+    pthread_mutex_lock(&r->lock);
+    r->tags[tag].busy = 0;
+    pthread_cond_signal(&r->tag_cond);
+    pthread_mutex_unlock(&r->lock);
+    return res;
+}
+
+void remote_detach(struct ddriver *dev) {
+    struct ddriver_remote *r = dev->remote;
+    int i;
+
+    if (r == NULL) {
+        return;
+    }
+    shutdown(r->sock, SHUT_RDWR);
+    pthread_join(r->rx, NULL);
+    close(r->sock);
+    for (i = 0; i < CONFIG_REMOTE_TAGS; i++) {
+        pthread_cond_destroy(&r->tags[i].cond);
+    }
+    pthread_cond_destroy(&r->tag_cond);
+    pthread_mutex_destroy(&r->send_lock);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+    dev->remote = NULL;
+}
+
+/* Connect and make sure the server's image holds the whole device */
+int remote_attach(struct ddriver *dev) {
+    struct ddriver_remote *r;
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int i, one = 1, ret;
+
+    if (dev->remote_addr == NULL) {
+        user_alert(dev, "remote backend needs DDRIVER_REMOTE=unix:<path>|tcp:<host>:<port>");
+        return -EINVAL;
+    }
+    ret = remote_sockaddr(dev->remote_addr, &ss, &len);
+    if (ret < 0) {
+        user_alert(dev, "bad remote address %s", dev->remote_addr);
+        return ret;
+    }
+    r = calloc(1, sizeof(struct ddriver_remote));
+    if (r == NULL) {
+        return -ENOMEM;
+    }
+    r->sock = socket(ss.ss_family, SOCK_STREAM, 0);
+    if (r->sock < 0 || connect(r->sock, (struct sockaddr *)&ss, len) < 0) {
+        ret = -errno;
+        user_alert(dev, "can't reach %s: %s", dev->remote_addr, strerror(errno));
+        if (r->sock >= 0) {
+            close(r->sock);
+        }
+        free(r);
+        return ret;
+    }
+    if (ss.ss_family != AF_UNIX) {
+        setsockopt(r->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_mutex_init(&r->send_lock, NULL);
+    pthread_cond_init(&r->tag_cond, NULL);
+    for (i = 0; i < CONFIG_REMOTE_TAGS; i++) {
+        pthread_cond_init(&r->tags[i].cond, NULL);
+    }
+    if (pthread_create(&r->rx, NULL, remote_receiver, r) != 0) {
+        close(r->sock);
+        free(r);
+        return -EAGAIN;
+    }
+    dev->remote = r;
+
+    ret = remote_call(dev, DDRIVER_NET_HELLO, NULL, 0, 0, dev->layout_size);
+    if (ret < 0) {
+        user_alert(dev, "remote %s refused %llu bytes: %s", dev->remote_addr,
+                   (unsigned long long)dev->layout_size, strerror(-ret));
+        remote_detach(dev);
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * The server takes at most CONFIG_REMOTE_MAX_REQ payload bytes per request,
+ * larger transfers go out in pieces. Returns the bytes moved: a read the
+ * server answered short stops there, any error fails the whole call.
+ */
+static ssize_t remote_rw(struct ddriver *dev, int op, const struct iovec *iov, int iovcnt,
+                         off_t offset) {
+    struct iovec *sub;
+    size_t  done = 0, skip = 0, len, n;
+    ssize_t res = 0;
+    int i = 0, cnt;
+
+    sub = malloc((iovcnt > 0 ? iovcnt : 1) * sizeof(struct iovec));
+    if (sub == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    do {
+        for (cnt = 0, len = 0; i < iovcnt && len < CONFIG_REMOTE_MAX_REQ; cnt++) {
+            n = iov[i].iov_len - skip;
+            if (n > CONFIG_REMOTE_MAX_REQ - len)
+                n = CONFIG_REMOTE_MAX_REQ - len;
+            sub[cnt].iov_base = (char *)iov[i].iov_base + skip;
+            sub[cnt].iov_len  = n;
+            len  += n;
+            skip += n;
+            if (skip == iov[i].iov_len) {
+                i++;
+                skip = 0;
+            }
+        }
+        res = remote_call(dev, op, sub, cnt, offset + done, len);
+        if (res < 0)
+            break;
+        if (op == DDRIVER_NET_READ && (size_t)res < len) {
+            done += res;
+            break;
+        }
+        done += len;
+    } while (i < iovcnt);
+    free(sub);
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return done;
+}
+
+ssize_t remote_preadv(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return remote_rw(dev, DDRIVER_NET_READ, iov, iovcnt, offset);
+}
+
+ssize_t remote_pwritev(struct ddriver *dev, const struct iovec *iov, int iovcnt, off_t offset) {
+    return remote_rw(dev, DDRIVER_NET_WRITE, iov, iovcnt, offset);
+}
+
+/* Nothing to share across the wire, maps are bounce buffers as with the file backend */
+void* remote_map(struct ddriver *dev, off_t offset, size_t len) {
+    struct iovec iov = { .iov_base = malloc(len), .iov_len = len };
+    if (iov.iov_base == NULL) {
+        return NULL;
+    }
+    if (remote_preadv(dev, &iov, 1, offset) != (ssize_t)len) {
+        free(iov.iov_base);
+        errno = EIO;
+        return NULL;
+    }
+    return iov.iov_base;
+}
+
+int remote_unmap(struct ddriver *dev, void *addr, off_t offset, size_t len, int flags) {
+    struct iovec iov = { .iov_base = addr, .iov_len = len };
+    int ret = 0;
+    if ((flags & DDRIVER_MAP_WRITE) && remote_pwritev(dev, &iov, 1, offset) != (ssize_t)len) {
+        ret = -EIO;
+    }
+    free(addr);
+    return ret;
+}
+
+int remote_discard(struct ddriver *dev, off_t offset, size_t len) {
+    ssize_t res = remote_call(dev, DDRIVER_NET_DISCARD, NULL, 0, offset, len);
+    return res < 0 ? (int)res : 0;
+}
+
+const struct ddriver_backend_ops remote_backend_ops = {
+    .name    = "remote",
+    .attach  = remote_attach,
+    .detach  = remote_detach,
+    .preadv  = remote_preadv,
+    .pwritev = remote_pwritev,
+    .map     = remote_map,
+    .unmap   = remote_unmap,
+    .discard = remote_discard
+};
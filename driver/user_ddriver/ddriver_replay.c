@@ -0,0 +1,350 @@
+#include "ddriver_dev.h"
+
+/******************************************************************************
+* SECTION: ddriver_replay
+*
+* Re-issues a DDRIVER_TRACE recording against a scratch image, on virtual
+* time, and reports what the run would have cost on the chosen profile and
+* scheduler. Data is not recorded, so writes carry zeros.
+*******************************************************************************/
+#define REPLAY_IMAGE    "/tmp/ddriver_replay"
+#define REPLAY_ENTRIES  (1024)
+
+struct replay_opts
+{
+    int         profile;                             /* -1: follow the trace */
+    int         sched;                               /* -1: follow the trace */
+    int64_t     wcache;                              /* -1: follow the trace */
+    int         backend;
+    int         keep;
+    const char *image;
+    const char *trace;
+};
+
+static void usage(const char *prog) {
+    printf("用法: %s [options] <trace>\n", prog);
+    printf("options: \n");
+    printf("-p [hdd|ssd|nvme|ram]   使用指定延迟模型，忽略Trace中的切换\n");
+    printf("-s [noop|clook|scan]    使用指定调度策略，忽略Trace中的切换\n");
+    printf("-w size                 写缓存大小(可带K/M/G)，0关闭，忽略Trace中的设置\n");
+    printf("-b [file|mmap|direct]   后端\n");
+    printf("-o path                 回放镜像路径，默认%s\n", REPLAY_IMAGE);
+    printf("-k                      保留回放镜像\n");
+}
+
+static int parse_opts(int argc, char **argv, struct replay_opts *opts) {
+    int c;
+
+    opts->profile = -1;
+    opts->sched   = -1;
+    opts->wcache  = -1;
+    opts->backend = DDRIVER_BACKEND_FILE;
+    opts->keep    = 0;
+    opts->image   = REPLAY_IMAGE;
+    while ((c = getopt(argc, argv, "p:s:w:b:o:kh")) != -1) {
+        switch (c)
+        {
+        case 'p':
+            opts->profile = lookup_profile(optarg);
+            if (opts->profile < 0) {
+                fprintf(stderr, "unknown profile %s\n", optarg);
+                return -EINVAL;
+            }
+            break;
+        case 's':
+            opts->sched = lookup_sched(optarg);
+            if (opts->sched < 0) {
+                fprintf(stderr, "unknown scheduler %s\n", optarg);
+                return -EINVAL;
+            }
+            break;
+        case 'w':
+            opts->wcache = parse_size(optarg);
+            if (opts->wcache == 0 && strcmp(optarg, "0") != 0) {
+                fprintf(stderr, "bad cache size %s\n", optarg);
+                return -EINVAL;
+            }
+            break;
+        case 'b':
+            opts->backend = lookup_backend(optarg);
+            if (opts->backend < 0) {
+                fprintf(stderr, "unknown backend %s\n", optarg);
+                return -EINVAL;
+            }
+            break;
+        case 'o': opts->image = optarg;     break;
+        case 'k': opts->keep = 1;           break;
+        default:  return -EINVAL;
+        }
+    }
+    if (optind != argc - 1) {
+        return -EINVAL;
+    }
+    opts->trace = argv[optind];
+    return 0;
+}
+
+/* One scratch buffer serves every request; its contents never matter */
+static char *replay_buf(uint64_t size) {
+    static char    *buf;
+    static uint64_t cap;
+    char *grown;
+
+    if (size > cap) {
+        grown = realloc(buf, size);
+        if (grown == NULL) {
+            return NULL;
+        }
+        memset(grown, 0, size);
+        buf = grown;
+        cap = size;
+    }
+    return buf;
+}
+
+/* The scratch image, its log and any composite members */
+static void remove_image(const char *image, int members) {
+    char path[CONFIG_PATH_LEN + sizeof(DEVICE_LOG) + sizeof(DEVICE_MEMBER) + 8];
+    int i;
+
+    unlink(image);
+    snprintf(path, sizeof(path), "%s" DEVICE_LOG, image);
+    unlink(path);
+    for (i = 0; i < members; i++) {
+        snprintf(path, sizeof(path), "%s" DEVICE_MEMBER, image, i);
+        unlink(path);
+    }
+}
+
+static int replay_drain(int fd, int *inflight) {
+    struct ddriver_cqe cqes[64];
+    int i, n;
+
+    while (*inflight > 0) {
+        n = ddriver_reap(fd, cqes, 64, 1);
+        if (n < 0) {
+            return n;
+        }
+        for (i = 0; i < n; i++) {
+            if (cqes[i].res < 0) {
+                fprintf(stderr, "queued request failed: %s\n", strerror(-cqes[i].res));
+            }
+        }
+        *inflight -= n;
+    }
+    return 0;
+}
+
+static int replay_queued(int fd, const struct ddriver_trace_rec *rec, char *buf, int *inflight) {
+    struct ddriver_sqe *sqe = ddriver_get_sqe(fd);
+    int ret;
+
+    if (sqe == NULL) {
+        /* Batch larger than the replay queue, split it */
+        ret = ddriver_submit(fd);
+        if (ret < 0) {
+            return ret;
+        }
+        *inflight += ret;
+        ret = replay_drain(fd, inflight);
+        if (ret < 0) {
+            return ret;
+        }
+        sqe = ddriver_get_sqe(fd);
+    }
+    sqe->op     = rec->op == DDRIVER_TRACE_WRITE ? DDRIVER_OP_WRITE : DDRIVER_OP_READ;
+    sqe->buf    = buf;
+    sqe->size   = rec->size;
+    sqe->offset = rec->offset;
+    return 0;
+}
+
+static int replay_ioctl(int fd, const struct ddriver_trace_rec *rec, const struct replay_opts *opts) {
+    uint64_t value = rec->offset;
+    int value32 = (int)rec->offset;
+
+    switch (rec->aux)
+    {
+    case (uint32_t)IOC_REQ_DEVICE_RESET:
+        return ddriver_ioctl(fd, IOC_REQ_DEVICE_RESET, NULL);
+    case (uint32_t)IOC_SET_DEVICE_SIZE:
+        return ddriver_ioctl(fd, IOC_SET_DEVICE_SIZE, &value);
+    case (uint32_t)IOC_SET_DEVICE_IO_SZ:
+        return ddriver_ioctl(fd, IOC_SET_DEVICE_IO_SZ, &value32);
+    case (uint32_t)IOC_SET_DEVICE_PROFILE:
+        return opts->profile < 0 ? ddriver_ioctl(fd, IOC_SET_DEVICE_PROFILE, &value32) : 0;
+    case (uint32_t)IOC_SET_DEVICE_SCHED:
+        return opts->sched < 0 ? ddriver_ioctl(fd, IOC_SET_DEVICE_SCHED, &value32) : 0;
+    case (uint32_t)IOC_SET_DEVICE_WCACHE:
+        return opts->wcache < 0 ? ddriver_ioctl(fd, IOC_SET_DEVICE_WCACHE, &value) : 0;
+    case (uint32_t)IOC_REQ_DEVICE_FLUSH:
+        return ddriver_ioctl(fd, IOC_REQ_DEVICE_FLUSH, NULL);
+    default:
+        return 0;                                    /* Queries change nothing */
+    }
+}
+
+static void report(int fd, uint64_t records, uint64_t wall_ns) {
+    struct ddriver_state_v2 st;
+    struct ddriver_profile_info info;
+    struct ddriver_sched_state sched;
+    struct ddriver_wcache_state wcache;
+    uint64_t clock_ns;
+    uint64_t ops;
+    double   secs;
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_V2, &st);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_PROFILE, &info);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SCHED, &sched);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock_ns);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_WCACHE, &wcache);
+    ops  = st.read_cnt + st.write_cnt;
+    secs = clock_ns / 1e9;
+
+    printf("trace:      %llu records over %.3f s\n", (unsigned long long)records, wall_ns / 1e9);
+    printf("device:     %s, scheduler %s\n", info.name, sched_names[sched.policy]);
+    printf("reads:      %llu (%llu bytes)\n", (unsigned long long)st.read_cnt,
+           (unsigned long long)st.read_bytes);
+    printf("writes:     %llu (%llu bytes)\n", (unsigned long long)st.write_cnt,
+           (unsigned long long)st.write_bytes);
+    printf("seeks:      %llu (%llu bytes travelled, max %llu)\n", (unsigned long long)st.seek_cnt,
+           (unsigned long long)st.seek_dist, (unsigned long long)st.seek_dist_max);
+    printf("discards:   %llu (%llu bytes)\n", (unsigned long long)st.discard_cnt,
+           (unsigned long long)st.discard_bytes);
+    printf("merged:     %d\n", sched.merged_cnt);
+    if (wcache.size > 0) {
+        printf("wcache:     %llu bytes, %llu absorbed, %llu read hits, %llu destaged in %llu, %llu flushes\n",
+               (unsigned long long)wcache.size, (unsigned long long)wcache.absorbed,
+               (unsigned long long)wcache.read_hits, (unsigned long long)wcache.destage_bytes,
+               (unsigned long long)wcache.destage_cnt, (unsigned long long)wcache.flush_cnt);
+    }
+    printf("modeled:    %.3f ms\n", clock_ns / 1e6);
+    if (secs > 0) {
+        printf("throughput: %.2f MiB/s, %.0f IOPS\n",
+               (st.read_bytes + st.write_bytes) / secs / (1024 * 1024), ops / secs);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct replay_opts opts;
+    struct ddriver_config cfg;
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec rec;
+    uint64_t records = 0, wall_ns = 0;
+    uint64_t wcache;
+    int inflight = 0;
+    int fd, ret = 0;
+    char *buf;
+    FILE *tf;
+
+    if (parse_opts(argc, argv, &opts) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    tf = fopen(opts.trace, "r");
+    if (tf == NULL) {
+        fprintf(stderr, "can't open %s: %s\n", opts.trace, strerror(errno));
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, tf) != 1 ||
+        memcmp(hdr.magic, DDRIVER_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != DDRIVER_TRACE_VERSION) {
+        fprintf(stderr, "%s is not a ddriver trace\n", opts.trace);
+        fclose(tf);
+        return 1;
+    }
+
+    /* Modeled time only, and never trace the replay itself */
+    setenv("DDRIVER_SIMTIME", "1", 1);
+    unsetenv("DDRIVER_TRACE");
+    unsetenv("DDRIVER_WCACHE");
+    unsetenv("DDRIVER_LAYOUT");
+    remove_image(opts.image, hdr.members);
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.disk_size  = hdr.disk_size;
+    cfg.io_size    = hdr.io_size;
+    cfg.backend    = opts.backend;
+    cfg.layout     = hdr.layout;
+    cfg.members    = hdr.members;
+    cfg.chunk_size = hdr.chunk_size;
+    fd = ddriver_open_ex((char *)opts.image, &cfg);
+    if (fd < 0) {
+        fprintf(stderr, "can't open replay image %s: %s\n", opts.image, strerror(-fd));
+        fclose(tf);
+        return 1;
+    }
+    ret = opts.profile < 0 ? hdr.profile : opts.profile;
+    ddriver_ioctl(fd, IOC_SET_DEVICE_PROFILE, &ret);
+    ret = opts.sched < 0 ? hdr.sched : opts.sched;
+    ddriver_ioctl(fd, IOC_SET_DEVICE_SCHED, &ret);
+    wcache = opts.wcache < 0 ? hdr.wcache_size : (uint64_t)opts.wcache;
+    ddriver_ioctl(fd, IOC_SET_DEVICE_WCACHE, &wcache);
+    ret = ddriver_queue_init(fd, REPLAY_ENTRIES);
+    if (ret < 0) {
+        fprintf(stderr, "can't init queue: %s\n", strerror(-ret));
+        goto out;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, tf) == 1) {
+        records++;
+        wall_ns = rec.ts_ns;
+        switch (rec.op)
+        {
+        case DDRIVER_TRACE_SEEK:
+            ret = ddriver_seek(fd, rec.offset, SEEK_SET) < 0 ? -EINVAL : 0;
+            break;
+        case DDRIVER_TRACE_READ:
+        case DDRIVER_TRACE_WRITE:
+            buf = replay_buf(rec.size);
+            if (buf == NULL) {
+                ret = -ENOMEM;
+            }
+            else if (rec.aux & DDRIVER_TRACE_F_QUEUED) {
+                ret = replay_queued(fd, &rec, buf, &inflight);
+            }
+            else if (rec.op == DDRIVER_TRACE_WRITE) {
+                ret = ddriver_pwrite(fd, buf, rec.size, rec.offset);
+            }
+            else {
+                ret = ddriver_pread(fd, buf, rec.size, rec.offset);
+            }
+            break;
+        case DDRIVER_TRACE_DISCARD:
+            ret = ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD,
+                                &(struct ddriver_range){ rec.offset, rec.size });
+            break;
+        case DDRIVER_TRACE_IOCTL:
+            ret = replay_ioctl(fd, &rec, &opts);
+            break;
+        case DDRIVER_TRACE_SUBMIT:
+            ret = ddriver_submit(fd);
+            if (ret >= 0) {
+                inflight += ret;
+                ret = replay_drain(fd, &inflight);
+            }
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "record %llu (op %u) failed: %s\n",
+                    (unsigned long long)records, rec.op, strerror(-ret));
+            break;
+        }
+    }
+    if (ret >= 0) {
+        /* Data still in the write cache would otherwise go uncharged */
+        ddriver_ioctl(fd, IOC_REQ_DEVICE_FLUSH, NULL);
+        report(fd, records, wall_ns);
+        ret = 0;
+    }
+
+out:
+    fclose(tf);
+    ddriver_close(fd);
+    if (!opts.keep) {
+        remove_image(opts.image, hdr.members);
+    }
+    return ret < 0 ? 1 : 0;
+}
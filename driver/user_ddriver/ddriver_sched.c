@@ -0,0 +1,143 @@
+#include "ddriver_dev.h"
+
+/******************************************************************************
+* SECTION: I/O scheduler
+*
+* Orders one submitted batch of the asynchronous queue before it is charged.
+* Synchronous calls are served one at a time and never reach here. Batches
+* are small (at most CONFIG_AIO_ENTRIES_MAX), so plain scans are fine.
+*******************************************************************************/
+const char *sched_names[DDRIVER_SCHED_NUM] = {
+    [DDRIVER_SCHED_NOOP]  = "noop",
+    [DDRIVER_SCHED_CLOOK] = "clook",
+    [DDRIVER_SCHED_SCAN]  = "scan",
+};
+
+struct sched_ent
+{
+    off_t    off;
+    off_t    end;
+    unsigned idx;                                    /* Caller's index */
+    unsigned arrival;
+    int      done;
+};
+
+static int sched_ent_cmp(const void *a, const void *b) {
+    const struct sched_ent *x = a, *y = b;
+    if (x->off != y->off)
+        return x->off < y->off ? -1 : 1;
+    return x->arrival < y->arrival ? -1 : (x->arrival > y->arrival);
+}
+
+int lookup_sched(const char *name) {
+    int i;
+    for (i = 0; i < DDRIVER_SCHED_NUM; i++) {
+        if (strcmp(sched_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+/* Serve everything at or past the head in ascending order, then wrap to the lowest */
+static void sched_clook(struct sched_ent *ents, unsigned n, off_t head, unsigned *order) {
+    unsigned p, d = 0, first = n;
+
+    for (p = 0; p < n; p++) {
+        if (ents[p].off >= head) {
+            first = p;
+            break;
+        }
+    }
+    for (p = first; p < n; p++)
+        order[d++] = ents[p].idx;
+    for (p = 0; p < first; p++)
+        order[d++] = ents[p].idx;
+}
+
+static int sched_pick(struct sched_ent *ents, unsigned n, off_t cur, int dir) {
+    int p;
+    if (dir > 0) {
+        for (p = 0; p < (int)n; p++)
+            if (!ents[p].done && ents[p].off >= cur)
+                return p;
+    }
+    else {
+        for (p = n - 1; p >= 0; p--)
+            if (!ents[p].done && ents[p].off <= cur)
+                return p;
+    }
+    return -1;
+}
+
+/* Elevator sweep; a request overtaken by CONFIG_SCHED_DEADLINE others goes next */
+static void sched_scan(struct sched_ent *ents, unsigned n, off_t head, unsigned *order,
+                       unsigned *pos_of) {
+    unsigned d, oldest = 0;
+    off_t cur = head;
+    int dir = 1, pick;
+
+    for (d = 0; d < n; d++)
+        pos_of[ents[d].arrival] = d;
+
+    for (d = 0; d < n; d++) {
+        while (ents[pos_of[oldest]].done)
+            oldest++;
+        if (d >= oldest + CONFIG_SCHED_DEADLINE) {
+            pick = pos_of[oldest];
+        }
+        else {
+            pick = sched_pick(ents, n, cur, dir);
+            if (pick < 0) {
+                dir  = -dir;
+                pick = sched_pick(ents, n, cur, dir);
+            }
+        }
+        ents[pick].done = 1;
+        order[d] = ents[pick].idx;
+        cur = ents[pick].end;
+    }
+}
+
+/**
+ * @brief 按调度策略重排一批请求
+ *
+ * @param policy DDRIVER_SCHED_*
+ * @param head 当前磁头位置
+ * @param offs 各请求起始位置
+ * @param sizes 各请求大小
+ * @param order 输入为到达顺序的下标，输出为服务顺序
+ * @param n 请求个数
+ */
+void sched_order(int policy, off_t head, const off_t *offs, const size_t *sizes,
+                 unsigned *order, unsigned n) {
+    struct sched_ent *ents;
+    unsigned *pos_of;
+    unsigned i;
+
+    if (policy == DDRIVER_SCHED_NOOP || n < 2)
+        return;
+    ents   = malloc(n * sizeof(struct sched_ent));
+    pos_of = malloc(n * sizeof(unsigned));
+    if (ents == NULL || pos_of == NULL) {
+        /* Arrival order is always a valid schedule */
+        free(ents);
+        free(pos_of);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        ents[i].idx     = order[i];
+        ents[i].off     = offs[order[i]];
+        ents[i].end     = offs[order[i]] + sizes[order[i]];
+        ents[i].arrival = i;
+        ents[i].done    = 0;
+    }
+    qsort(ents, n, sizeof(struct sched_ent), sched_ent_cmp);
+
+    if (policy == DDRIVER_SCHED_CLOOK)
+        sched_clook(ents, n, head, order);
+    else
+        sched_scan(ents, n, head, order, pos_of);
+    free(pos_of);
+    free(ents);
+}
@@ -0,0 +1,346 @@
+#define _GNU_SOURCE                                  /* fallocate */
+#include "ddriver_dev.h"
+#include <pthread.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/******************************************************************************
+* SECTION: ddriver_server
+*
+* Stands in for a remote storage node: serves one image to DDRIVER_BACKEND=
+* remote clients. It only stores bytes; the latency model stays with the
+* client. Each connection gets a reader that queues requests and a few
+* workers that serve them, so responses go back in completion order, not
+* request order.
+*******************************************************************************/
+struct server_req
+{
+    struct ddriver_net_req hdr;
+    char *payload;                                   /* Write data, NULL otherwise */
+    struct server_req *next;
+};
+
+struct server_conn
+{
+    int             sock;
+    int             closing;                         /* Reader hit EOF, drain and exit */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_mutex_t send_lock;
+    struct server_req *head, *tail;
+    pthread_t       workers[CONFIG_SERVER_WORKERS];
+    int             nworkers;                        /* Workers actually started */
+};
+
+static int image_fd = -1;
+static int verbose;
+
+static void usage(const char *prog) {
+    printf("用法: %s [options] <image>\n", prog);
+    printf("options: \n");
+    printf("-l addr                 监听地址，unix:<path>或tcp:<host>:<port>，默认unix:<image>%s\n",
+           DEVICE_SOCK);
+    printf("-v                      打印每个连接\n");
+}
+
+static int send_full(int sock, struct iovec *iov, int iovcnt) {
+    struct msghdr msg;
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iovcnt;
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -EPIPE;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int recv_full(int sock, void *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = recv(sock, buf, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -EPIPE;
+        buf  = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Grow the image to at least size, a larger image is kept as is */
+static int serve_hello(uint64_t size) {
+    int ret = posix_fallocate(image_fd, 0, size);
+    return -ret;
+}
+
+static int serve_read(char *buf, uint64_t offset, uint64_t len) {
+    ssize_t n;
+    uint64_t done = 0;
+
+    while (done < len) {
+        n = pread(image_fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+        if (n == 0) {
+            /* Past the end of a sparse image reads as zeros */
+            memset(buf + done, 0, len - done);
+            break;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int serve_write(const char *buf, uint64_t offset, uint64_t len) {
+    ssize_t n;
+    uint64_t done = 0;
+
+    while (done < len) {
+        n = pwrite(image_fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? -errno : -EIO;
+        done += n;
+    }
+    return 0;
+}
+
+static int serve_discard(uint64_t offset, uint64_t len) {
+    char zeros[64 * 1024];
+    uint64_t done, chunk;
+    int ret;
+
+    if (fallocate(image_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0 ||
+        fallocate(image_fd, FALLOC_FL_ZERO_RANGE, offset, len) == 0) {
+        return 0;
+    }
+    memset(zeros, 0, sizeof(zeros));
+    for (done = 0; done < len; done += chunk) {
+        chunk = len - done < sizeof(zeros) ? len - done : sizeof(zeros);
+        ret = serve_write(zeros, offset + done, chunk);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static void serve_one(struct server_conn *c, struct server_req *req) {
+    struct ddriver_net_rsp rsp;
+    struct iovec iov[2];
+    char *buf = NULL;
+    int ret;
+
+    switch (req->hdr.op)
+    {
+    case DDRIVER_NET_HELLO:   ret = serve_hello(req->hdr.len);                          break;
+    case DDRIVER_NET_WRITE:   ret = serve_write(req->payload, req->hdr.offset, req->hdr.len); break;
+    case DDRIVER_NET_DISCARD: ret = serve_discard(req->hdr.offset, req->hdr.len);       break;
+    case DDRIVER_NET_READ:
+        buf = malloc(req->hdr.len);
+        ret = buf == NULL ? -ENOMEM : serve_read(buf, req->hdr.offset, req->hdr.len);
+        break;
+    default:                  ret = -EINVAL;                                             break;
+    }
+
+    rsp.magic = DDRIVER_NET_MAGIC;
+    rsp.res   = ret;
+    rsp.tag   = req->hdr.tag;
+    rsp.len   = req->hdr.op == DDRIVER_NET_READ && ret == 0 ? req->hdr.len : 0;
+    iov[0].iov_base = &rsp;
+    iov[0].iov_len  = sizeof(rsp);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = rsp.len;
+    pthread_mutex_lock(&c->send_lock);
+    send_full(c->sock, iov, rsp.len > 0 ? 2 : 1);
+    pthread_mutex_unlock(&c->send_lock);
+    free(buf);
+}
+
+static void *server_worker(void *arg) {
+    struct server_conn *c = arg;
+    struct server_req *req;
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        while (c->head == NULL && !c->closing) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        req = c->head;
+        if (req == NULL) {
+            pthread_mutex_unlock(&c->lock);
+            return NULL;
+        }
+        c->head = req->next;
+        if (c->head == NULL)
+            c->tail = NULL;
+        pthread_mutex_unlock(&c->lock);
+
+        serve_one(c, req);
+        free(req->payload);
+        free(req);
+    }
+}
+
+/* Reader side of one connection; exits when the client hangs up */
+static void *server_conn(void *arg) {
+    struct server_conn *c = arg;
+    struct server_req *req;
+    int i;
+
+    for (i = 0; i < CONFIG_SERVER_WORKERS; i++) {
+        if (pthread_create(&c->workers[i], NULL, server_worker, c) != 0) {
+            break;
+        }
+        c->nworkers++;
+    }
+    /* Without a worker nobody would answer, so hang up at once */
+    while (c->nworkers > 0) {
+        req = calloc(1, sizeof(struct server_req));
+        if (req == NULL || recv_full(c->sock, &req->hdr, sizeof(req->hdr)) < 0 ||
+            req->hdr.magic != DDRIVER_NET_MAGIC ||
+            ((req->hdr.op == DDRIVER_NET_READ || req->hdr.op == DDRIVER_NET_WRITE) &&
+             req->hdr.len > CONFIG_REMOTE_MAX_REQ)) {
+            free(req);
+            break;
+        }
+        if (req->hdr.op == DDRIVER_NET_WRITE) {
+            req->payload = malloc(req->hdr.len);
+            if (req->payload == NULL ||
+                recv_full(c->sock, req->payload, req->hdr.len) < 0) {
+                free(req->payload);
+                free(req);
+                break;
+            }
+        }
+        pthread_mutex_lock(&c->lock);
+        if (c->tail != NULL)
+            c->tail->next = req;
+        else
+            c->head = req;
+        c->tail = req;
+        pthread_cond_signal(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->closing = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    for (i = 0; i < c->nworkers; i++) {
+        pthread_join(c->workers[i], NULL);
+    }
+    if (verbose) {
+        printf("connection %d closed\n", c->sock);
+    }
+    close(c->sock);
+    pthread_mutex_destroy(&c->lock);
+    pthread_mutex_destroy(&c->send_lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    char addr_buf[CONFIG_PATH_LEN + sizeof(DEVICE_SOCK) + 5];
+    const char *addr = NULL;
+    struct sockaddr_storage ss;
+    struct server_conn *c;
+    socklen_t len;
+    pthread_t tid;
+    int lsock, sock, opt, one = 1;
+
+    while ((opt = getopt(argc, argv, "l:vh")) != -1) {
+        switch (opt)
+        {
+        case 'l': addr = optarg;    break;
+        case 'v': verbose = 1;      break;
+        default:  usage(argv[0]);   return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (addr == NULL) {
+        snprintf(addr_buf, sizeof(addr_buf), "unix:%s" DEVICE_SOCK, argv[optind]);
+        addr = addr_buf;
+    }
+
+    image_fd = open(argv[optind], O_CREAT | O_RDWR, 0644);
+    if (image_fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (remote_sockaddr(addr, &ss, &len) < 0) {
+        fprintf(stderr, "bad address %s\n", addr);
+        return 1;
+    }
+    if (ss.ss_family == AF_UNIX) {
+        unlink(addr + 5);
+    }
+    lsock = socket(ss.ss_family, SOCK_STREAM, 0);
+    setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lsock < 0 || bind(lsock, (struct sockaddr *)&ss, len) < 0 || listen(lsock, 16) < 0) {
+        fprintf(stderr, "can't listen on %s: %s\n", addr, strerror(errno));
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("serving %s on %s\n", argv[optind], addr);
+    fflush(stdout);
+
+    for (;;) {
+        sock = accept(lsock, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        if (ss.ss_family != AF_UNIX) {
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        c = calloc(1, sizeof(struct server_conn));
+        if (c == NULL) {
+            close(sock);
+            continue;
+        }
+        c->sock = sock;
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_mutex_init(&c->send_lock, NULL);
+        pthread_cond_init(&c->cond, NULL);
+        if (verbose) {
+            printf("connection %d\n", sock);
+        }
+        if (pthread_create(&tid, NULL, server_conn, c) != 0) {
+            close(sock);
+            free(c);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(lsock);
+    close(image_fd);
+    return 1;
+}
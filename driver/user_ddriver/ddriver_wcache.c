@@ -0,0 +1,166 @@
+#include "ddriver_dev.h"
+
+/******************************************************************************
+* SECTION: Volatile write cache
+*
+* Timing model only: the bytes still reach the backend right away, what the
+* cache changes is when the media cost is paid. Absorbed writes cost
+* CONFIG_WCACHE_LAT plus bus transfer and leave the head alone; dirty extents
+* are written back in offset order when the cache fills, on
+* IOC_REQ_DEVICE_FLUSH, on geometry changes and on close.
+* Everything here runs under the device's model_lock.
+*******************************************************************************/
+static uint64_t wcache_hit_cost(struct ddriver *dev, size_t size) {
+    return CONFIG_WCACHE_LAT + model_transfer(dev, 0, size);
+}
+
+static int extent_cmp(const void *a, const void *b) {
+    const struct ddriver_extent *x = a, *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief 设置写缓存大小，0关闭。调整前先回写所有脏数据
+ *
+ * @param dev 设备
+ * @param size 缓存字节数
+ * @param cost 回写产生的模拟耗时(ns)，由调用者计费
+ * @return int 0成功，否则失败
+ */
+int wcache_resize(struct ddriver *dev, uint64_t size, uint64_t *cost) {
+    *cost = wcache_destage(dev);
+    if (size == 0) {
+        free(dev->wcache_ext);
+        dev->wcache_ext = NULL;
+    }
+    else if (dev->wcache_ext == NULL) {
+        dev->wcache_ext = calloc(CONFIG_WCACHE_EXTENTS, sizeof(struct ddriver_extent));
+        if (dev->wcache_ext == NULL) {
+            dev->wcache.size = 0;
+            return -ENOMEM;
+        }
+    }
+    dev->wcache.size = size;
+    return 0;
+}
+
+/* Write everything back in offset order, merging touching extents into one command */
+uint64_t wcache_destage(struct ddriver *dev) {
+    struct ddriver_extent *ext = dev->wcache_ext;
+    uint64_t cost = 0;
+    off_t    offset, end;
+    int i, j;
+
+    if (dev->wcache_ext_cnt == 0) {
+        return 0;
+    }
+    qsort(ext, dev->wcache_ext_cnt, sizeof(struct ddriver_extent), extent_cmp);
+    for (i = 0; i < dev->wcache_ext_cnt; i = j) {
+        offset = ext[i].offset;
+        end    = ext[i].offset + ext[i].len;
+        for (j = i + 1; j < dev->wcache_ext_cnt && ext[j].offset <= end; j++) {
+            if (ext[j].offset + (off_t)ext[j].len > end)
+                end = ext[j].offset + ext[j].len;
+        }
+        cost += model_access(dev, DDRIVER_OP_WRITE, offset, end - offset, NULL);
+        dev->wcache.destage_cnt++;
+        dev->wcache.destage_bytes += end - offset;
+    }
+    dev->wcache_ext_cnt = 0;
+    dev->wcache.dirty   = 0;
+    return cost;
+}
+
+/**
+ * @brief 尝试让写缓存吸收一次写入
+ *
+ * @param dev 设备
+ * @param offset 写入位置
+ * @param size 写入大小
+ * @param cost 吸收时的模拟耗时(ns)，含因缓存满触发的回写
+ * @return int 1为已吸收，0为需要直接写介质
+ */
+int wcache_write(struct ddriver *dev, off_t offset, size_t size, uint64_t *cost) {
+    struct ddriver_extent *ext;
+    off_t end = offset + size;
+    int i;
+
+    if (dev->wcache.size == 0 || size > dev->wcache.size) {
+        return 0;
+    }
+    *cost = 0;
+    if (dev->wcache.dirty + size > dev->wcache.size || dev->wcache_ext_cnt == CONFIG_WCACHE_EXTENTS) {
+        *cost += wcache_destage(dev);
+    }
+
+    /* Fold every extent this one overlaps or touches into it */
+    for (i = 0; i < dev->wcache_ext_cnt; ) {
+        ext = &dev->wcache_ext[i];
+        if (ext->offset <= end && offset <= ext->offset + (off_t)ext->len) {
+            if (ext->offset < offset)
+                offset = ext->offset;
+            if (ext->offset + (off_t)ext->len > end)
+                end = ext->offset + ext->len;
+            dev->wcache.dirty -= ext->len;
+            *ext = dev->wcache_ext[--dev->wcache_ext_cnt];
+            continue;
+        }
+        i++;
+    }
+    ext = &dev->wcache_ext[dev->wcache_ext_cnt++];
+    ext->offset = offset;
+    ext->len    = end - offset;
+    dev->wcache.dirty += ext->len;
+    dev->wcache.absorbed++;
+
+    *cost += wcache_hit_cost(dev, size);
+    return 1;
+}
+
+/**
+ * @brief 读请求完全落在脏数据内时由缓存直接返回
+ *
+ * @param dev 设备
+ * @param offset 读出位置
+ * @param size 读出大小
+ * @param cost 命中时的模拟耗时(ns)
+ * @return int 1为命中，0为未命中
+ */
+int wcache_read(struct ddriver *dev, off_t offset, size_t size, uint64_t *cost) {
+    struct ddriver_extent *ext;
+    int i;
+
+    for (i = 0; i < dev->wcache_ext_cnt; i++) {
+        ext = &dev->wcache_ext[i];
+        if (ext->offset <= offset && offset + (off_t)size <= ext->offset + (off_t)ext->len) {
+            dev->wcache.read_hits++;
+            *cost = wcache_hit_cost(dev, size);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Reset loses whatever the cache held, like a power cut */
+void wcache_drop(struct ddriver *dev) {
+    dev->wcache_ext_cnt = 0;
+    dev->wcache.dirty   = 0;
+}
+
+/* Dirty extents wholly inside a discarded range need no write-back */
+void wcache_discard(struct ddriver *dev, off_t offset, size_t len) {
+    struct ddriver_extent *ext;
+    int i;
+
+    for (i = 0; i < dev->wcache_ext_cnt; ) {
+        ext = &dev->wcache_ext[i];
+        if (offset <= ext->offset && ext->offset + ext->len <= offset + len) {
+            dev->wcache.dirty -= ext->len;
+            *ext = dev->wcache_ext[--dev->wcache_ext_cnt];
+            continue;
+        }
+        i++;
+    }
+}
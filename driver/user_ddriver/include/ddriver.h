@@ -3,11 +3,24 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 int ddriver_open(char *path);
-int ddriver_seek(int fd, off_t offset, int whence);
+int ddriver_open_ex(char *path, const struct ddriver_config *cfg);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+void *ddriver_map(int fd, off_t offset, size_t len, int flags);
+int ddriver_unmap(int fd, void *addr);
+int ddriver_queue_init(int fd, unsigned entries);
+struct ddriver_sqe *ddriver_get_sqe(int fd);
+int ddriver_submit(int fd);
+int ddriver_reap(int fd, struct ddriver_cqe *cqes, int max, int min_complete);
+int ddriver_queue_exit(int fd);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
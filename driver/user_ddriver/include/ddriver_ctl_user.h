@@ -2,6 +2,8 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <stdint.h>
+#include <sys/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,9 +15,158 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
+#define DDRIVER_LAT_BUCKETS     32      /* log2 buckets of modeled ns */
+#define DDRIVER_HEAT_REGIONS    256     /* Device split evenly by offset */
+
+struct ddriver_state_v2
+{
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t seek_cnt;
+    uint64_t discard_cnt;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t read_sect_cnt;             /* I/O units moved by reads */
+    uint64_t write_sect_cnt;            /* I/O units moved by writes */
+    uint64_t discard_bytes;
+    uint64_t seek_dist;                 /* Total head travel in bytes */
+    uint64_t seek_dist_max;
+    uint64_t read_lat_hist[DDRIVER_LAT_BUCKETS];   /* [0]: 0 ns, [i]: [2^(i-1), 2^i) ns */
+    uint64_t write_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t region_size;               /* Bytes per heatmap region */
+    uint64_t region_read[DDRIVER_HEAT_REGIONS];    /* Bytes read per region */
+    uint64_t region_write[DDRIVER_HEAT_REGIONS];   /* Bytes written per region */
+};
+
+struct ddriver_wcache_state
+{
+    uint64_t size;                      /* Cache bytes, 0 when disabled */
+    uint64_t dirty;                     /* Bytes not yet on media */
+    uint64_t absorbed;                  /* Writes that completed at cache speed */
+    uint64_t read_hits;                 /* Reads served from dirty data */
+    uint64_t destage_cnt;               /* Write-back commands */
+    uint64_t destage_bytes;
+    uint64_t flush_cnt;
+};
+
+struct ddriver_member_state
+{
+    int      member;                    /* In: 0 .. members - 1 */
+    int      members;
+    uint64_t head;
+    struct ddriver_state    state;      /* As IOC_REQ_DEVICE_STATE, for this member */
+    struct ddriver_state_v2 stat;
+};
+
+struct ddriver_config
+{
+    uint64_t disk_size;                 /* 0: DDRIVER_DISK_SZ, image size or 4 MiB */
+    int      io_size;                   /* 0: DDRIVER_IO_SZ or 512 */
+    int      backend;                   /* 0: DDRIVER_BACKEND or file */
+    int      layout;                    /* 0: DDRIVER_LAYOUT or single */
+    int      members;                   /* 0: DDRIVER_MEMBERS or 2 */
+    int      chunk_size;                /* 0: DDRIVER_CHUNK_SZ or 64 KiB */
+};
+
+enum ddriver_layout {
+    DDRIVER_LAYOUT_SINGLE,
+    DDRIVER_LAYOUT_STRIPE,
+    DDRIVER_LAYOUT_MIRROR,
+    DDRIVER_LAYOUT_NUM
+};
+
+enum ddriver_backend {
+    DDRIVER_BACKEND_FILE,
+    DDRIVER_BACKEND_MMAP,
+    DDRIVER_BACKEND_DIRECT,
+    DDRIVER_BACKEND_REMOTE,
+    DDRIVER_BACKEND_NUM
+};
+
+#define DDRIVER_MAP_READ        0x1
+#define DDRIVER_MAP_WRITE       0x2
+
+enum ddriver_op {
+    DDRIVER_OP_READ,
+    DDRIVER_OP_WRITE
+};
+
+struct ddriver_sqe
+{
+    int      op;                        /* DDRIVER_OP_* */
+    char    *buf;
+    size_t   size;
+    off_t    offset;
+    uint64_t user_data;                 /* Echoed back in the completion */
+};
+
+struct ddriver_cqe
+{
+    uint64_t user_data;
+    int      res;                       /* Bytes moved or -errno */
+};
+
+struct ddriver_range
+{
+    uint64_t offset;                    /* Aligned to the I/O unit */
+    uint64_t len;                       /* Multiple of the I/O unit */
+};
+
+enum ddriver_sched {
+    DDRIVER_SCHED_NOOP,                 /* Arrival order */
+    DDRIVER_SCHED_CLOOK,                /* Ascending sweep, jump back to lowest */
+    DDRIVER_SCHED_SCAN,                 /* Elevator, starvation bounded */
+    DDRIVER_SCHED_NUM
+};
+
+struct ddriver_sched_state
+{
+    int      policy;                    /* DDRIVER_SCHED_* */
+    int      merged_cnt;                /* Requests folded into an adjacent one */
+    uint64_t fifo_seek_dist;            /* Head travel (bytes) in arrival order */
+    uint64_t seek_dist;                 /* Head travel (bytes) actually modeled */
+    uint64_t fifo_seek_ns;              /* Seek time in arrival order */
+    uint64_t seek_ns;                   /* Seek time actually modeled */
+};
+
+enum ddriver_profile {
+    DDRIVER_PROFILE_HDD,
+    DDRIVER_PROFILE_SSD,
+    DDRIVER_PROFILE_NVME,
+    DDRIVER_PROFILE_RAM,
+    DDRIVER_PROFILE_NUM
+};
+
+struct ddriver_profile_info
+{
+    int      id;
+    char     name[16];
+    uint64_t read_lat;                  /* ns */
+    uint64_t write_lat;                 /* ns */
+    uint64_t seek_lat;                  /* ns per track */
+    uint64_t xfer_lat;                  /* ns per sector per channel */
+    int      track_num;
+    int      channels;
+    int      queue_depth;
+};
+
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, uint64_t)
+#define IOC_REQ_DEVICE_SIZE_LEGACY _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 4, uint64_t)
+#define IOC_SET_DEVICE_PROFILE  _IOW(IOC_MAGIC, 5, int)
+#define IOC_REQ_DEVICE_PROFILE  _IOR(IOC_MAGIC, 6, struct ddriver_profile_info)
+#define IOC_SET_DEVICE_SIZE     _IOW(IOC_MAGIC, 7, uint64_t)
+#define IOC_SET_DEVICE_IO_SZ    _IOW(IOC_MAGIC, 8, int)
+#define IOC_SET_DEVICE_SCHED    _IOW(IOC_MAGIC, 9, int)
+#define IOC_REQ_DEVICE_SCHED    _IOR(IOC_MAGIC, 10, struct ddriver_sched_state)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 11, struct ddriver_range)
+#define IOC_REQ_DEVICE_STATE_V2 _IOR(IOC_MAGIC, 12, struct ddriver_state_v2)
+#define IOC_SET_DEVICE_WCACHE   _IOW(IOC_MAGIC, 13, uint64_t)
+#define IOC_REQ_DEVICE_WCACHE   _IOR(IOC_MAGIC, 14, struct ddriver_wcache_state)
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 15)
+#define IOC_REQ_DEVICE_MEMBER_STATE _IOWR(IOC_MAGIC, 16, struct ddriver_member_state)
 
 #endif
\ No newline at end of file
@@ -5,7 +5,7 @@
 #include "stdio.h"
 
 int ddriver_open(char *path);
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
@@ -3,32 +3,42 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 /**
- * @brief 打开ddriver设备
+ * @brief 打开ddriver设备，可打开任意路径的镜像，每个句柄有独立的计数、延迟模型和日志(<path>_log)
  * 
- * @param path ddriver设备路径
- * @return int 0成功，否则失败
+ * @param path ddriver设备路径，NULL时为$HOME/ddriver
+ * @return int 设备句柄，负数为错误码
  */
 int ddriver_open(char *path);
 
+/**
+ * @brief 按配置打开ddriver设备
+ * 
+ * @param path ddriver设备路径
+ * @param cfg 设备大小及IO单位配置，可为NULL
+ * @return int 设备句柄，负数为错误码
+ */
+int ddriver_open_ex(char *path, const struct ddriver_config *cfg);
+
 /**
  * @brief 移动ddriver磁盘头
  * 
  * @param fd ddriver设备handler
  * @param offset 移动到的位置，注意要和设备IO单位对齐
  * @param whence SEEK_SET即可
- * @return int 0成功，否则失败
+ * @return off_t 磁盘头新位置，负数为错误码
  */
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 
 /**
  * @brief 写入数据
  * 
  * @param fd ddriver设备handler
  * @param buf 要写入的数据Buf
- * @param size 要写入的数据大小，注意一定要等于单次设备IO单位
- * @return int 0成功，否则失败
+ * @param size 要写入的数据大小，注意一定要是设备IO单位的整数倍
+ * @return int 写入字节数，负数为错误码
  */
 int ddriver_write(int fd, char *buf, size_t size);
 
@@ -37,11 +47,117 @@ int ddriver_write(int fd, char *buf, size_t size);
  * 
  * @param fd ddriver设备handler
  * @param buf 要读出的数据Buf
- * @param size 要读出的数据大小，注意一定要等于单次设备IO单位
- * @return int 
+ * @param size 要读出的数据大小，注意一定要是设备IO单位的整数倍
+ * @return int 读出字节数，负数为错误码
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 向量写入，从当前磁盘头开始把iovcnt段数据连续写入，只计一次传输延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 数据段数组，每段大小都要是设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @return int 写入字节数，负数为错误码
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 向量读出，从当前磁盘头开始连续读出数据到iovcnt段Buf中，只计一次传输延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 数据段数组，每段大小都要是设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @return int 读出字节数，负数为错误码
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 定位写入，寻道在设备内部模拟，不使用也不修改fd的共享偏移
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，注意一定要是设备IO单位的整数倍
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 写入字节数，负数为错误码
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 定位读出，寻道在设备内部模拟，不使用也不修改fd的共享偏移
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，注意一定要是设备IO单位的整数倍
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 读出字节数，负数为错误码
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 映射一段设备空间，MMAP后端直接返回指向设备的指针(零拷贝)，FILE后端返回回写缓冲
+ * 
+ * @param fd ddriver设备handler
+ * @param offset 起始位置，注意要和设备IO单位对齐
+ * @param len 长度，注意一定要是设备IO单位的整数倍
+ * @param flags DDRIVER_MAP_READ / DDRIVER_MAP_WRITE，决定计数与延迟如何统计
+ * @return void* 映射地址，失败返回NULL并设置errno
+ */
+void *ddriver_map(int fd, off_t offset, size_t len, int flags);
+
+/**
+ * @brief 解除ddriver_map的映射，带DDRIVER_MAP_WRITE时计一次写
+ * 
+ * @param fd ddriver设备handler
+ * @param addr ddriver_map返回的地址
+ * @return int 0成功，否则失败
+ */
+int ddriver_unmap(int fd, void *addr);
+
+/**
+ * @brief 为设备建立异步提交/完成队列，优先使用io_uring，不可用时退回工作线程
+ * 
+ * @param fd ddriver设备handler
+ * @param entries 队列深度，0使用默认值64
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_init(int fd, unsigned entries);
+
+/**
+ * @brief 取一个空闲的提交项，填好op/buf/size/offset/user_data后由ddriver_submit提交
+ * 
+ * @param fd ddriver设备handler
+ * @return struct ddriver_sqe* 提交项，队列满时返回NULL
+ */
+struct ddriver_sqe *ddriver_get_sqe(int fd);
+
+/**
+ * @brief 提交所有已填写的提交项，延迟按设备通道数和队列深度重叠计算
+ * 
+ * @param fd ddriver设备handler
+ * @return int 提交的请求数，负数为错误码
+ */
+int ddriver_submit(int fd);
+
+/**
+ * @brief 收割已完成的请求，完成顺序不一定与提交顺序相同
+ * 
+ * @param fd ddriver设备handler
+ * @param cqes 完成项数组，user_data与提交时相同，res为字节数或负的错误码
+ * @param max 最多收割个数
+ * @param min_complete 至少等到这么多个完成才返回，0为不等待
+ * @return int 收割到的完成项个数，负数为错误码
+ */
+int ddriver_reap(int fd, struct ddriver_cqe *cqes, int max, int min_complete);
+
+/**
+ * @brief 等待在途请求完成并释放队列，ddriver_close也会自动调用
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_exit(int fd);
+
 /**
  * @brief ddriver IO控制
  * 
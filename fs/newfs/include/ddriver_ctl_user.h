@@ -2,6 +2,8 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <stdint.h>
+#include <sys/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,9 +15,159 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
+/* 打开配置，值为0的项依次取环境变量(DDRIVER_DISK_SZ / DDRIVER_IO_SZ)、已有镜像大小、默认值(4MiB / 512B) */
+#define DDRIVER_LAT_BUCKETS     32      /* log2 buckets of modeled ns */
+#define DDRIVER_HEAT_REGIONS    256     /* Device split evenly by offset */
+
+struct ddriver_state_v2
+{
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t seek_cnt;
+    uint64_t discard_cnt;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t read_sect_cnt;             /* I/O units moved by reads */
+    uint64_t write_sect_cnt;            /* I/O units moved by writes */
+    uint64_t discard_bytes;
+    uint64_t seek_dist;                 /* Total head travel in bytes */
+    uint64_t seek_dist_max;
+    uint64_t read_lat_hist[DDRIVER_LAT_BUCKETS];   /* [0]: 0 ns, [i]: [2^(i-1), 2^i) ns */
+    uint64_t write_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t region_size;               /* Bytes per heatmap region */
+    uint64_t region_read[DDRIVER_HEAT_REGIONS];    /* Bytes read per region */
+    uint64_t region_write[DDRIVER_HEAT_REGIONS];   /* Bytes written per region */
+};
+
+struct ddriver_wcache_state
+{
+    uint64_t size;                      /* Cache bytes, 0 when disabled */
+    uint64_t dirty;                     /* Bytes not yet on media */
+    uint64_t absorbed;                  /* Writes that completed at cache speed */
+    uint64_t read_hits;                 /* Reads served from dirty data */
+    uint64_t destage_cnt;               /* Write-back commands */
+    uint64_t destage_bytes;
+    uint64_t flush_cnt;
+};
+
+struct ddriver_member_state
+{
+    int      member;                    /* 输入：成员编号 */
+    int      members;                   /* 成员个数 */
+    uint64_t head;                      /* 该成员的磁头位置 */
+    struct ddriver_state    state;      /* 该成员的计数，含义同IOC_REQ_DEVICE_STATE */
+    struct ddriver_state_v2 stat;       /* 该成员的64位计数、直方图与热度图 */
+};
+
+struct ddriver_config
+{
+    uint64_t disk_size;                 /* 设备大小，支持超过2GiB */
+    int      io_size;                   /* 设备IO单位 */
+    int      backend;                   /* DDRIVER_BACKEND_*，0时取环境变量DDRIVER_BACKEND=file|mmap|direct|remote */
+    int      layout;                    /* DDRIVER_LAYOUT_*，0时取环境变量DDRIVER_LAYOUT=single|stripe|mirror */
+    int      members;                   /* 组合设备成员数，0时取DDRIVER_MEMBERS或2 */
+    int      chunk_size;                /* 条带单元，0时取DDRIVER_CHUNK_SZ或64KiB */
+};
+
+enum ddriver_layout {
+    DDRIVER_LAYOUT_SINGLE,              /* 单个镜像 */
+    DDRIVER_LAYOUT_STRIPE,              /* RAID-0，按条带单元轮流分布到<path>.0 ... <path>.N-1 */
+    DDRIVER_LAYOUT_MIRROR,              /* RAID-1，写所有成员，读磁头最近的成员 */
+    DDRIVER_LAYOUT_NUM
+};
+
+enum ddriver_backend {
+    DDRIVER_BACKEND_FILE,               /* 每次IO为一次pread/pwrite系统调用 */
+    DDRIVER_BACKEND_MMAP,               /* 镜像整体mmap，IO为memcpy，ddriver_map零拷贝 */
+    DDRIVER_BACKEND_DIRECT,             /* O_DIRECT，不占用主机页缓存，未对齐的Buf经对齐的中转缓冲 */
+    DDRIVER_BACKEND_REMOTE,             /* 数据在ddriver_server上，地址取DDRIVER_REMOTE=unix:<path>|tcp:<host>:<port>，默认unix:<镜像路径>.sock */
+    DDRIVER_BACKEND_NUM
+};
+
+#define DDRIVER_MAP_READ        0x1     /* ddriver_map时计一次读 */
+#define DDRIVER_MAP_WRITE       0x2     /* ddriver_unmap时计一次写(FILE后端会写回) */
+
+enum ddriver_op {
+    DDRIVER_OP_READ,
+    DDRIVER_OP_WRITE
+};
+
+struct ddriver_sqe
+{
+    int      op;                        /* DDRIVER_OP_* */
+    char    *buf;
+    size_t   size;
+    off_t    offset;
+    uint64_t user_data;                 /* Echoed back in the completion */
+};
+
+struct ddriver_cqe
+{
+    uint64_t user_data;
+    int      res;                       /* Bytes moved or -errno */
+};
+
+struct ddriver_range
+{
+    uint64_t offset;                    /* Aligned to the I/O unit */
+    uint64_t len;                       /* Multiple of the I/O unit */
+};
+
+enum ddriver_sched {
+    DDRIVER_SCHED_NOOP,                 /* Arrival order */
+    DDRIVER_SCHED_CLOOK,                /* Ascending sweep, jump back to lowest */
+    DDRIVER_SCHED_SCAN,                 /* Elevator, starvation bounded */
+    DDRIVER_SCHED_NUM
+};
+
+struct ddriver_sched_state
+{
+    int      policy;                    /* DDRIVER_SCHED_* */
+    int      merged_cnt;                /* Requests folded into an adjacent one */
+    uint64_t fifo_seek_dist;            /* Head travel (bytes) in arrival order */
+    uint64_t seek_dist;                 /* Head travel (bytes) actually modeled */
+    uint64_t fifo_seek_ns;              /* Seek time in arrival order */
+    uint64_t seek_ns;                   /* Seek time actually modeled */
+};
+
+enum ddriver_profile {
+    DDRIVER_PROFILE_HDD,
+    DDRIVER_PROFILE_SSD,
+    DDRIVER_PROFILE_NVME,
+    DDRIVER_PROFILE_RAM,
+    DDRIVER_PROFILE_NUM
+};
+
+struct ddriver_profile_info
+{
+    int      id;
+    char     name[16];
+    uint64_t read_lat;                  /* ns */
+    uint64_t write_lat;                 /* ns */
+    uint64_t seek_lat;                  /* ns per track */
+    uint64_t xfer_lat;                  /* ns per sector per channel */
+    int      track_num;
+    int      channels;
+    int      queue_depth;
+};
+
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, uint64_t)                /* 请求查看设备大小，64位 */
+#define IOC_REQ_DEVICE_SIZE_LEGACY _IOR(IOC_MAGIC, 0, int)                  /* 旧版32位设备大小，超过INT_MAX时截断 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 4, uint64_t)                /* 请求设备模拟时钟(ns)，DDRIVER_SIMTIME=1时不真实睡眠 */
+#define IOC_SET_DEVICE_PROFILE  _IOW(IOC_MAGIC, 5, int)                     /* 切换设备延迟模型，DDRIVER_PROFILE_*，也可用环境变量DDRIVER_PROFILE=hdd|ssd|nvme|ram */
+#define IOC_REQ_DEVICE_PROFILE  _IOR(IOC_MAGIC, 6, struct ddriver_profile_info) /* 请求当前设备延迟模型 */
+#define IOC_SET_DEVICE_SIZE     _IOW(IOC_MAGIC, 7, uint64_t)                /* 调整设备大小(格式化时使用)，需为IO单位整数倍 */
+#define IOC_SET_DEVICE_IO_SZ    _IOW(IOC_MAGIC, 8, int)                     /* 调整设备IO单位，512B到1MiB间的2的幂 */
+#define IOC_SET_DEVICE_SCHED    _IOW(IOC_MAGIC, 9, int)                     /* 切换异步队列调度策略，DDRIVER_SCHED_*，也可用环境变量DDRIVER_SCHED=noop|clook|scan */
+#define IOC_REQ_DEVICE_SCHED    _IOR(IOC_MAGIC, 10, struct ddriver_sched_state) /* 请求调度统计，可与FIFO顺序比较节省的寻道 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 11, struct ddriver_range)  /* 丢弃一段空间(打洞)，之后读出全0，不计延迟 */
+#define IOC_REQ_DEVICE_STATE_V2 _IOR(IOC_MAGIC, 12, struct ddriver_state_v2) /* 64位统计：次数、字节、寻道距离、延迟直方图、区域热度图 */
+#define IOC_SET_DEVICE_WCACHE   _IOW(IOC_MAGIC, 13, uint64_t)               /* 设置写缓存大小(字节)，0关闭，也可用环境变量DDRIVER_WCACHE */
+#define IOC_REQ_DEVICE_WCACHE   _IOR(IOC_MAGIC, 14, struct ddriver_wcache_state) /* 请求写缓存状态 */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 15)                          /* 刷写屏障，把缓存中的脏数据按偏移顺序回写到介质 */
+#define IOC_REQ_DEVICE_MEMBER_STATE _IOWR(IOC_MAGIC, 16, struct ddriver_member_state) /* 组合设备单个成员的计数，非组合设备返回-EINVAL */
 
 #endif
\ No newline at end of file
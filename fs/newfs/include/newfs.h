@@ -11,8 +11,9 @@
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
-#include "types.h"
 #include "stdint.h"
+#include <pthread.h>
+#include "types.h"
 
 #define NEWFS_MAGIC           0x22011013       /* TODO: Define by yourself */
 #define NEWFS_DEFAULT_PERM    0777   /* 全权限打开 */
@@ -22,12 +23,22 @@
 *******************************************************************************/
 #define NFS_DBG(fmt, ...) do { printf("nfs_DBG: " fmt, ##__VA_ARGS__); } while(0) 
 /******************************************************************************
+* SECTION: macro lock
+*******************************************************************************/
+/* 整个文件系统一把递归锁：FUSE多线程调用各操作，回写线程也要改同一份内存结构 */
+#define NFS_LOCK()        pthread_mutex_lock(&nfs_super.lock)
+#define NFS_UNLOCK()      pthread_mutex_unlock(&nfs_super.lock)
+/******************************************************************************
 * SECTION: nfs_utils.c
 *******************************************************************************/
 char* 			   nfs_get_fname(const char* path);
 int 			   nfs_calc_lvl(const char * path);
 int 			   nfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   nfs_driver_write(int offset, uint8_t *in_content, int size);
+void               nfs_io_reset();
+int                nfs_io_queue(int blk, uint8_t *data);
+int                nfs_io_end(struct nfs_io_stat* stat);
+void               nfs_io_report();
 
 
 int 			   nfs_mount(struct custom_options options);
@@ -36,8 +47,12 @@ int 			   nfs_umount();
 int 			   nfs_alloc_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 int 			   nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 int                nfs_alloc_data();
+void               nfs_free_data(int dno);
 struct nfs_inode*  nfs_alloc_inode(struct nfs_dentry * dentry);
 int 			   nfs_sync_inode(struct nfs_inode * inode);
+void               nfs_mark_dirty(struct nfs_inode * inode, flag16 flags);
+int                nfs_sync_dirty();
+int                nfs_fsync_inode(struct nfs_inode * inode);
 int 			   nfs_drop_inode(struct nfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
@@ -46,6 +61,29 @@ int 			   nfs_read_file(struct nfs_inode* inode, char* data, int length, int off
 int 			   nfs_write_file(struct nfs_inode* inode, const char* data, int length, int offset);
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int                nfs_cache_init(int capacity);
+void               nfs_cache_destroy();
+int                nfs_cache_enabled();
+struct nfs_buf*    nfs_cache_get(int blk, boolean fill);
+void               nfs_cache_put(struct nfs_buf* buf, boolean dirty);
+int                nfs_cache_read(int offset, uint8_t *out_content, int size);
+int                nfs_cache_write(int offset, uint8_t *in_content, int size);
+int                nfs_cache_sync(struct nfs_io_stat* stat);
+int                nfs_cache_dirty();
+int                nfs_cache_flush(int offset, int size, struct nfs_io_stat* stat);
+
+/******************************************************************************
+* SECTION: newfs_flush.c
+*******************************************************************************/
+uint64_t           nfs_now_ms();
+int                nfs_writeback();
+int                nfs_flusher_start(struct custom_options options);
+void               nfs_flusher_stop();
+void               nfs_balance_dirty();
+
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
@@ -69,5 +107,8 @@ int   			   newfs_truncate(const char *, off_t);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   newfs_flush(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
 
 #endif  /* _newfs_H_ */
\ No newline at end of file
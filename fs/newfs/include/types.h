@@ -44,8 +44,20 @@ typedef enum nfs_file_type {
 #define NFS_IOC_MAGIC           'S'
 #define NFS_IOC_SEEK            _IO(NFS_IOC_MAGIC, 0)
 
-#define NFS_FLAG_BUF_DIRTY      0x1
-#define NFS_FLAG_BUF_OCCUPY     0x2
+#define NFS_FLAG_BUF_DIRTY      0x1     /* 缓存块比磁盘新，淘汰或sync时写回 */
+#define NFS_FLAG_BUF_OCCUPY     0x2     /* 缓存块已装入某个逻辑块 */
+#define NFS_FLAG_INODE_DIRTY    0x1     /* inode_d与磁盘不一致 */
+#define NFS_FLAG_DATA_DIRTY     0x2     /* 文件数据或目录块（子dentry）与磁盘不一致 */
+#define NFS_FLAG_ON_DIRTY_LIST  0x4     /* 已挂在nfs_super.dirty_inodes上 */
+#define NFS_FLAG_SUPER_DIRTY    0x1     /* 以下用于nfs_super.flags */
+#define NFS_FLAG_MAP_INODE_DIRTY 0x2
+#define NFS_FLAG_MAP_DATA_DIRTY 0x4
+#define NFS_CACHE_BLKS          256     /* 缓存默认容量（逻辑块），--cache_blks覆盖 */
+#define NFS_IO_RUN_BLKS         64      /* 一次合并写最多带几个逻辑块 */
+#define NFS_DIRTY_BG_BYTES      (64 * 1024)   /* 脏数据超过它就唤醒回写线程，--dirty_bytes覆盖 */
+#define NFS_DIRTY_MAX_BYTES     (192 * 1024)  /* 超过它由写者自己回写，--dirty_max_bytes覆盖 */
+#define NFS_DIRTY_EXPIRE_MS     5000          /* 脏数据最长停留时间，--dirty_expire覆盖 */
+#define NFS_FLUSH_INTERVAL_MS   1000          /* 回写线程最长睡多久检查一次 */
 
 #define NFS_SUPER_BLKS          1       /* 超级块占1个逻辑块 */
 #define NFS_MAP_INODE_BLKS      1       /* 索引节点位图占1个逻辑块 */
@@ -64,6 +76,7 @@ typedef enum nfs_file_type {
 #define NFS_DISK_SZ()                   (nfs_super.sz_disk)
 #define NFS_DRIVER()                    (nfs_super.fd)
 #define NFS_DENTRY_PER_DATABLK()        (NFS_BLK_SZ() / sizeof(struct nfs_dentry))      //计算一个逻辑块可以储存多少dentry
+#define NFS_DENTRY_D_PER_BLK()          ((NFS_BLK_SZ() - 1) / sizeof(struct nfs_dentry_d))  //磁盘上一个逻辑块实际放几个dentry_d，块尾至少留1字节
 #define NFS_BLKS_SZ(blks)               ((blks) * NFS_BLK_SZ())
 
 /* 取整函数 */
@@ -91,6 +104,11 @@ typedef enum nfs_file_type {
 
 struct custom_options {
 	const char*        device;
+	int                cache_blks;                    /* 缓存容量，0取默认值 */
+	int                nocache;                       /* 绕过缓存，直接读写设备 */
+	int                dirty_bytes;                   /* 以下0取默认值 */
+	int                dirty_max_bytes;
+	int                dirty_expire;                  /* 毫秒 */
 };
 
 struct nfs_inode
@@ -106,6 +124,9 @@ struct nfs_inode
     uint8_t*           data1;         
     int                dir_cnt;                         /* 如果是目录类型文件，下面有几个目录项 */
     int                block_allocted;                  /* 已分配数据块数量 */
+    flag16             flags;                           /* NFS_FLAG_INODE_DIRTY等 */
+    int                dirty_bytes;                     /* 计入nfs_super.dirty_bytes的部分 */
+    struct nfs_inode*  dirty_next;                      /* nfs_super.dirty_inodes链 */
 };  
 
 struct nfs_dentry
@@ -126,7 +147,7 @@ struct nfs_super
     /* 总体磁盘情况*/
     int                sz_io;
     int                sz_blks;
-    int                sz_disk;
+    uint64_t           sz_disk;
     int                sz_usage;
     
     /* 索引节点及索引位图相关情况*/
@@ -144,11 +165,83 @@ struct nfs_super
     int                data_offset;
 
     boolean            is_mounted;
+    flag16             flags;                         /* NFS_FLAG_SUPER_DIRTY等 */
+    struct nfs_inode*  dirty_inodes;                  /* 改动过、还没写回的inode */
+    int                dirty_cnt;                     /* dirty_inodes的长度 */
+    int                dirty_bytes;                   /* 脏inode待写回的字节数，不含位图 */
+    uint64_t           dirty_since;                   /* 脏链由空变非空的时刻，毫秒 */
+    pthread_mutex_t    lock;                          /* NFS_LOCK */
     
     /* 根目录 */
     struct nfs_dentry* root_dentry;
 };
 
+struct nfs_buf
+{
+    int                blk;                           /* 缓存的逻辑块号 */
+    flag16             flags;                         /* NFS_FLAG_BUF_* */
+    int                pin;                           /* 引用计数，非0时不可淘汰 */
+    uint8_t*           data;                          /* 一个逻辑块大小 */
+    struct nfs_buf*    hash_next;                     /* 同一哈希桶 */
+    struct nfs_buf*    lru_prev;                      /* 靠近最近使用端 */
+    struct nfs_buf*    lru_next;                      /* 靠近最久未用端 */
+};
+
+struct nfs_cache
+{
+    int                capacity;                      /* 最多缓存多少逻辑块，0为关闭 */
+    int                buf_cnt;                       /* 已分配的缓存块 */
+    int                dirty_cnt;
+    int                bucket_cnt;                    /* 2的幂 */
+    struct nfs_buf**   buckets;
+    struct nfs_buf*    lru_head;                      /* 最近使用 */
+    struct nfs_buf*    lru_tail;                      /* 最久未用，淘汰从这里开始 */
+
+    /* 统计 */
+    uint64_t           hits;
+    uint64_t           misses;
+    uint64_t           evictions;
+    uint64_t           writebacks;                    /* 写回设备的块数 */
+};
+
+/* nfs_io_queue的合并统计，每次回写一份，另有挂载以来的累计 */
+struct nfs_io_stat
+{
+    uint64_t           reqs;                          /* 排进来的块 */
+    uint64_t           overlaps;                      /* 同一块重复排入，后者覆盖前者 */
+    uint64_t           runs;                          /* 实际提交的写 */
+    uint64_t           seeks;
+    uint64_t           seeks_elided;                  /* 游标已在段首，省掉的寻道 */
+};
+
+struct nfs_flusher
+{
+    pthread_t          tid;
+    pthread_cond_t     cond;                          /* 配合nfs_super.lock，用于唤醒和停止 */
+    boolean            running;
+    boolean            stop;
+    int                bg_bytes;
+    int                max_bytes;
+    int                expire_ms;
+
+    /* 统计 */
+    uint64_t           bg_flushes;                    /* 超过bg_bytes触发 */
+    uint64_t           expired_flushes;               /* 超时触发 */
+    uint64_t           throttled;                     /* 写者被迫自己回写的次数 */
+    struct nfs_io_stat last_io;                       /* 最近一次回写的合并情况 */
+};
+
+struct nfs_io_stage
+{
+    int                start_blk;                     /* 当前待提交段的首块 */
+    int                blk_cnt;
+    struct iovec       iov[NFS_IO_RUN_BLKS];          /* iov[i]对应start_blk + i */
+    off_t              head;                          /* 设备游标，上一段写完停在这里 */
+
+    struct nfs_io_stat cur;                           /* 本次回写，nfs_io_end时并入total */
+    struct nfs_io_stat total;                         /* 挂载以来的累计，卸载时打印一次 */
+};
+
 static inline struct nfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype) {
     struct nfs_dentry * dentry = (struct nfs_dentry *)malloc(sizeof(struct nfs_dentry));
     memset(dentry, 0, sizeof(struct nfs_dentry));
@@ -13,6 +13,11 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--nocache", nocache),
+	OPTION("--dirty_bytes=%d", dirty_bytes),
+	OPTION("--dirty_max_bytes=%d", dirty_max_bytes),
+	OPTION("--dirty_expire=%d", dirty_expire),
 	FUSE_OPT_END
 };
 
@@ -38,6 +43,9 @@ static struct fuse_operations operations = {
 
 	.open = newfs_open,							
 	.opendir = newfs_opendir,
+	.fsync = newfs_fsync,					 /* 单个文件落盘，fsync */
+	.flush = newfs_flush,					 /* 每次close */
+	.release = newfs_release,				 /* 最后一次close */
 	.access = newfs_access
 };
 /******************************************************************************
@@ -101,6 +109,7 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	// 与sys中对应部分只改了名字
 
 	(void)mode;
+	NFS_LOCK();
 	boolean is_find, is_root;
 	char* fname;
 	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
@@ -108,10 +117,12 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	struct nfs_inode*  inode;
 
 	if (is_find) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_EXISTS;
 	}
 
 	if (NFS_IS_REG(last_dentry->inode)) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_UNSUPPORTED;
 	}
 
@@ -121,6 +132,8 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	inode  = nfs_alloc_inode(dentry);
 	nfs_alloc_dentry(last_dentry->inode, dentry);
 	
+	nfs_balance_dirty();
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 
 }
@@ -136,9 +149,11 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
 
 	
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
@@ -166,6 +181,7 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 		newfs_stat->st_blocks = NFS_DISK_SZ() / NFS_IO_SZ();
 		newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
 	}
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 }
 
@@ -192,6 +208,7 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
     /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
 
 	// 与sys中对应部分只改了名字
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	int		cur_dir = offset;
 
@@ -207,8 +224,10 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
 		if (sub_dentry) {
 			filler(buf, sub_dentry->fname, NULL, ++offset);
 		}
+		NFS_UNLOCK();
 		return NFS_ERROR_NONE;
 	}
+	NFS_UNLOCK();
 	return -NFS_ERROR_NOTFOUND;
 }
 
@@ -222,6 +241,7 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
  */
 int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	/* TODO: 解析路径，并创建相应的文件 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	
 	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
@@ -230,6 +250,7 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	char* fname;
 	
 	if (is_find == TRUE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_EXISTS;
 	}
 
@@ -248,6 +269,8 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	nfs_alloc_dentry(last_dentry->inode, dentry);
 	inode = nfs_alloc_inode(dentry);
 
+	nfs_balance_dirty();
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 }
 
@@ -278,27 +301,34 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
 	/* 选做 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int ret;
 	
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	inode = dentry->inode;
 	
 	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_ISDIR;	
 	}
 
-	if (NFS_BLKS_SZ(inode->size) < offset) {
+	if (inode->size < offset) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_SEEK;
 	}
 
-	nfs_write_file(inode, buf, size, offset);
+	ret = nfs_write_file(inode, buf, size, offset);
 
-	return size;
+	nfs_balance_dirty();
+	NFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -314,26 +344,32 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
 	/* 选做 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int ret;
 
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	inode = dentry->inode;
 	
 	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_ISDIR;	
 	}
 
-	if (NFS_BLKS_SZ(inode->size) < offset) {
+	if (inode->size < offset) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_SEEK;
 	}
 
-	nfs_read_file(inode, buf, size, offset);
-	return size;
+	ret = nfs_read_file(inode, buf, size, offset);
+	NFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -344,11 +380,13 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
  */
 int newfs_unlink(const char* path) {
 	/* 选做 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
 
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
@@ -356,6 +394,9 @@ int newfs_unlink(const char* path) {
 
 	nfs_drop_inode(inode);
 	nfs_drop_dentry(dentry->parent->inode, dentry);
+	free(dentry);
+	nfs_balance_dirty();
+	NFS_UNLOCK();
 	return NFS_ERROR_NONE;
 }
 
@@ -385,17 +426,21 @@ int newfs_rmdir(const char* path) {
  */
 int newfs_rename(const char* from, const char* to) {
 	/* 选做 */
+	NFS_LOCK();
 	int ret = NFS_ERROR_NONE;
 	boolean	is_find, is_root;
 	struct nfs_dentry* from_dentry = nfs_lookup(from, &is_find, &is_root);
 	struct nfs_inode*  from_inode;
 	struct nfs_dentry* to_dentry;
+	struct nfs_dentry* child;
 	mode_t mode = 0;
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	if (strcmp(from, to) == 0) {
+		NFS_UNLOCK();
 		return NFS_ERROR_NONE;
 	}
 
@@ -410,6 +455,7 @@ int newfs_rename(const char* from, const char* to) {
 	
 	ret = newfs_mknod(to, mode, NULL);
 	if (ret != NFS_ERROR_NONE) {					  /* 保证目的文件不存在 */
+		NFS_UNLOCK();
 		return ret;
 	}
 	
@@ -417,8 +463,16 @@ int newfs_rename(const char* from, const char* to) {
 	nfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
 	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
 	to_dentry->inode = from_inode;
+	from_inode->dentry = to_dentry;
+	for (child = from_inode->dentrys; child != NULL; child = child->brother) {
+		child->parent = to_dentry;					  /* 子目录项的parent不能再指向旧dentry */
+	}
+	nfs_mark_dirty(to_dentry->parent->inode, NFS_FLAG_DATA_DIRTY);	/* 目录项改指向，mknod时的标记可能已被回写 */
 	
 	nfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	free(from_dentry);
+	nfs_balance_dirty();
+	NFS_UNLOCK();
 	return ret;
 }
 
@@ -447,6 +501,53 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 把一个文件持久化，只写它自己的数据、inode、父目录块和位图
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只要求数据，但inode_d里的块号和大小是读回数据所必需的，照写
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)datasync;
+	NFS_LOCK();
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
+	int ret;
+
+	if (is_find == FALSE) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+
+	ret = nfs_fsync_inode(dentry->inode);
+	NFS_UNLOCK();
+	return ret;
+}
+/**
+ * @brief 每次close都会调用，不保证持久化，只在脏数据过多时催一下回写
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	NFS_LOCK();
+	nfs_balance_dirty();
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
+}
+/**
+ * @brief 文件最后一次close，open时没有分配fi->fh，无需释放
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	return NFS_ERROR_NONE;
+}
 /**
  * @brief 改变文件大小
  * 
@@ -456,24 +557,29 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  */
 int newfs_truncate(const char* path, off_t offset) {
 	/* 选做 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int ret;
 	
 	if (is_find == FALSE) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 	
 	inode = dentry->inode;
 
 	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_ISDIR;
 	}
 
-	nfs_write_file(inode, NULL, offset, 0);
+	ret = nfs_write_file(inode, NULL, offset, 0);
 
-	return NFS_ERROR_NONE;
-	return 0;
+	nfs_balance_dirty();
+	NFS_UNLOCK();
+	return ret < 0 ? ret : NFS_ERROR_NONE;
 }
 
 
@@ -491,6 +597,7 @@ int newfs_truncate(const char* path, off_t offset) {
  */
 int newfs_access(const char* path, int type) {
 	/* 选做: 解析路径，判断是否存在 */
+	NFS_LOCK();
 	boolean	is_find, is_root;
 	boolean is_access_ok = FALSE;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
@@ -515,6 +622,7 @@ int newfs_access(const char* path, int type) {
 	default:
 		break;
 	}
+	NFS_UNLOCK();
 	return is_access_ok ? NFS_ERROR_NONE : -NFS_ERROR_ACCESS;
 }	
 /******************************************************************************
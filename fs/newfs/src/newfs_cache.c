@@ -0,0 +1,373 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 块缓存
+*
+* 介于nfs_*逻辑与ddriver之间，以逻辑块为单位缓存磁盘内容。按块号哈希查找，
+* LRU链表决定淘汰顺序；写入只标记NFS_FLAG_BUF_DIRTY，淘汰或nfs_cache_sync时
+* 才写回设备。被pin住的块不会被淘汰，调用者可以在nfs_cache_get与
+* nfs_cache_put之间直接改写buf->data。
+*******************************************************************************/
+static struct nfs_cache nfs_cache;
+
+static struct nfs_buf** nfs_cache_bucket(int blk) {
+    return &nfs_cache.buckets[blk & (nfs_cache.bucket_cnt - 1)];
+}
+
+static struct nfs_buf* nfs_cache_lookup(int blk) {
+    struct nfs_buf* buf = *nfs_cache_bucket(blk);
+    while (buf != NULL && buf->blk != blk) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void nfs_cache_unhash(struct nfs_buf* buf) {
+    struct nfs_buf** link = nfs_cache_bucket(buf->blk);
+    while (*link != buf) {
+        link = &(*link)->hash_next;
+    }
+    *link = buf->hash_next;
+    buf->hash_next = NULL;
+}
+
+static void nfs_cache_lru_del(struct nfs_buf* buf) {
+    if (buf->lru_prev != NULL)
+        buf->lru_prev->lru_next = buf->lru_next;
+    else
+        nfs_cache.lru_head = buf->lru_next;
+    if (buf->lru_next != NULL)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        nfs_cache.lru_tail = buf->lru_prev;
+    buf->lru_prev = buf->lru_next = NULL;
+}
+
+static void nfs_cache_lru_add(struct nfs_buf* buf) {
+    buf->lru_prev = NULL;
+    buf->lru_next = nfs_cache.lru_head;
+    if (nfs_cache.lru_head != NULL)
+        nfs_cache.lru_head->lru_prev = buf;
+    else
+        nfs_cache.lru_tail = buf;
+    nfs_cache.lru_head = buf;
+}
+
+static int nfs_cache_writeback(struct nfs_buf* buf) {
+    if (ddriver_pwrite(NFS_DRIVER(), (char *)buf->data, NFS_BLK_SZ(),
+                       NFS_BLKS_SZ(buf->blk)) != NFS_BLK_SZ()) {
+        NFS_DBG("[%s] write back blk %d failed\n", __func__, buf->blk);
+        return -NFS_ERROR_IO;
+    }
+    buf->flags &= ~NFS_FLAG_BUF_DIRTY;
+    nfs_cache.dirty_cnt--;
+    nfs_cache.writebacks++;
+    return NFS_ERROR_NONE;
+}
+
+/* 未满时新分配一块，否则从LRU尾部找一块没被pin住的腾出来 */
+static struct nfs_buf* nfs_cache_grab() {
+    struct nfs_buf* buf;
+
+    if (nfs_cache.buf_cnt < nfs_cache.capacity) {
+        buf = (struct nfs_buf*)calloc(1, sizeof(struct nfs_buf));
+        if (buf == NULL) {
+            return NULL;
+        }
+        buf->data = (uint8_t *)malloc(NFS_BLK_SZ());
+        if (buf->data == NULL) {
+            free(buf);
+            return NULL;
+        }
+        buf->blk = -1;
+        nfs_cache.buf_cnt++;
+        return buf;
+    }
+
+    for (buf = nfs_cache.lru_tail; buf != NULL; buf = buf->lru_prev) {
+        if (buf->pin == 0) {
+            break;
+        }
+    }
+    if (buf == NULL) {
+        NFS_DBG("[%s] all %d buffers pinned\n", __func__, nfs_cache.capacity);
+        return NULL;
+    }
+    if ((buf->flags & NFS_FLAG_BUF_DIRTY) && nfs_cache_writeback(buf) != NFS_ERROR_NONE) {
+        return NULL;
+    }
+    if (buf->flags & NFS_FLAG_BUF_OCCUPY) {
+        nfs_cache_unhash(buf);
+        nfs_cache.evictions++;
+    }
+    nfs_cache_lru_del(buf);
+    buf->flags = 0;
+    buf->blk   = -1;
+    return buf;
+}
+
+static int nfs_cache_blk_cmp(const void* a, const void* b) {
+    const struct nfs_buf* x = *(const struct nfs_buf**)a;
+    const struct nfs_buf* y = *(const struct nfs_buf**)b;
+    return x->blk - y->blk;
+}
+/**
+ * @brief 初始化块缓存，需在超级块的块大小确定之后调用
+ *
+ * @param capacity 最多缓存的逻辑块数，0关闭缓存
+ * @return int
+ */
+int nfs_cache_init(int capacity) {
+    memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+    if (capacity <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    nfs_cache.bucket_cnt = 1;
+    while (nfs_cache.bucket_cnt < capacity) {
+        nfs_cache.bucket_cnt <<= 1;
+    }
+    nfs_cache.buckets = (struct nfs_buf**)calloc(nfs_cache.bucket_cnt, sizeof(struct nfs_buf*));
+    if (nfs_cache.buckets == NULL) {
+        return -ENOMEM;
+    }
+    nfs_cache.capacity = capacity;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 写回全部脏块并释放缓存
+ *
+ * @return void
+ */
+void nfs_cache_destroy() {
+    struct nfs_buf* buf;
+
+    if (!nfs_cache_enabled()) {
+        return;
+    }
+    nfs_cache_sync(NULL);
+    NFS_DBG("[%s] hits %llu misses %llu evictions %llu writebacks %llu\n", __func__,
+            (unsigned long long)nfs_cache.hits, (unsigned long long)nfs_cache.misses,
+            (unsigned long long)nfs_cache.evictions, (unsigned long long)nfs_cache.writebacks);
+    while ((buf = nfs_cache.lru_head) != NULL) {
+        nfs_cache_lru_del(buf);
+        free(buf->data);
+        free(buf);
+    }
+    free(nfs_cache.buckets);
+    memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+}
+
+int nfs_cache_enabled() {
+    return nfs_cache.capacity > 0;
+}
+
+int nfs_cache_dirty() {
+    return nfs_cache.dirty_cnt;
+}
+/**
+ * @brief 取得逻辑块blk的缓存块并pin住，用完必须nfs_cache_put
+ *
+ * @param blk 逻辑块号
+ * @param fill 未命中时是否从磁盘读入；调用者将整块覆盖时传FALSE，省去一次读
+ * @return struct nfs_buf* 失败返回NULL
+ */
+struct nfs_buf* nfs_cache_get(int blk, boolean fill) {
+    struct nfs_buf* buf = nfs_cache_lookup(blk);
+
+    if (buf != NULL) {
+        nfs_cache.hits++;
+        nfs_cache_lru_del(buf);
+        nfs_cache_lru_add(buf);
+        buf->pin++;
+        return buf;
+    }
+
+    nfs_cache.misses++;
+    buf = nfs_cache_grab();
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (fill) {
+        if (ddriver_pread(NFS_DRIVER(), (char *)buf->data, NFS_BLK_SZ(),
+                          NFS_BLKS_SZ(blk)) != NFS_BLK_SZ()) {
+            NFS_DBG("[%s] read blk %d failed\n", __func__, blk);
+            /* 空块挂到LRU尾部，下次优先复用 */
+            buf->lru_next = NULL;
+            buf->lru_prev = nfs_cache.lru_tail;
+            if (nfs_cache.lru_tail != NULL)
+                nfs_cache.lru_tail->lru_next = buf;
+            else
+                nfs_cache.lru_head = buf;
+            nfs_cache.lru_tail = buf;
+            return NULL;
+        }
+    }
+    else {
+        memset(buf->data, 0, NFS_BLK_SZ());
+    }
+
+    buf->blk       = blk;
+    buf->flags     = NFS_FLAG_BUF_OCCUPY;
+    buf->pin       = 1;
+    buf->hash_next = *nfs_cache_bucket(blk);
+    *nfs_cache_bucket(blk) = buf;
+    nfs_cache_lru_add(buf);
+    return buf;
+}
+/**
+ * @brief 释放nfs_cache_get的pin
+ *
+ * @param buf
+ * @param dirty 调用者是否改写了buf->data
+ * @return void
+ */
+void nfs_cache_put(struct nfs_buf* buf, boolean dirty) {
+    if (dirty && !(buf->flags & NFS_FLAG_BUF_DIRTY)) {
+        buf->flags |= NFS_FLAG_BUF_DIRTY;
+        nfs_cache.dirty_cnt++;
+    }
+    buf->pin--;
+}
+/**
+ * @brief 经缓存读，offset和size不要求对齐
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int nfs_cache_read(int offset, uint8_t *out_content, int size) {
+    struct nfs_buf* buf;
+    int bias, len;
+
+    while (size > 0) {
+        bias = offset % NFS_BLK_SZ();
+        len  = NFS_BLK_SZ() - bias < size ? NFS_BLK_SZ() - bias : size;
+        buf  = nfs_cache_get(offset / NFS_BLK_SZ(), TRUE);
+        if (buf == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + bias, len);
+        nfs_cache_put(buf, FALSE);
+        offset      += len;
+        out_content += len;
+        size        -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 经缓存写，只改缓存块并标脏；整块覆盖时不读盘
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int nfs_cache_write(int offset, uint8_t *in_content, int size) {
+    struct nfs_buf* buf;
+    int bias, len;
+
+    while (size > 0) {
+        bias = offset % NFS_BLK_SZ();
+        len  = NFS_BLK_SZ() - bias < size ? NFS_BLK_SZ() - bias : size;
+        buf  = nfs_cache_get(offset / NFS_BLK_SZ(), len != NFS_BLK_SZ());
+        if (buf == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        nfs_cache_put(buf, TRUE);
+        offset     += len;
+        in_content += len;
+        size       -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 按块号顺序写回全部脏块，相邻的块合并成一次写，缓存内容保留
+ *
+ * @param stat 非NULL时返回这次写回的合并统计
+ * @return int
+ */
+int nfs_cache_sync(struct nfs_io_stat* stat) {
+    struct nfs_buf** dirty;
+    struct nfs_buf*  buf;
+    int cnt = 0, i, ret = NFS_ERROR_NONE;
+
+    if (stat != NULL) {
+        memset(stat, 0, sizeof(struct nfs_io_stat));
+    }
+    if (nfs_cache.dirty_cnt == 0) {
+        return NFS_ERROR_NONE;
+    }
+    dirty = (struct nfs_buf**)malloc(nfs_cache.dirty_cnt * sizeof(struct nfs_buf*));
+    if (dirty == NULL) {
+        return -ENOMEM;
+    }
+    for (buf = nfs_cache.lru_head; buf != NULL; buf = buf->lru_next) {
+        if (buf->flags & NFS_FLAG_BUF_DIRTY) {
+            dirty[cnt++] = buf;
+        }
+    }
+    qsort(dirty, cnt, sizeof(struct nfs_buf*), nfs_cache_blk_cmp);
+    for (i = 0; i < cnt && ret == NFS_ERROR_NONE; i++) {
+        ret = nfs_io_queue(dirty[i]->blk, dirty[i]->data);
+    }
+    if (nfs_io_end(stat) != NFS_ERROR_NONE || ret != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] write back failed\n", __func__);
+        free(dirty);
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < cnt; i++) {
+        dirty[i]->flags &= ~NFS_FLAG_BUF_DIRTY;
+    }
+    nfs_cache.dirty_cnt  -= cnt;
+    nfs_cache.writebacks += cnt;
+    free(dirty);
+    return ret;
+}
+/**
+ * @brief 只写回[offset, offset + size)覆盖到的脏块，供fsync使用
+ *
+ * @param offset
+ * @param size
+ * @param stat 非NULL时返回这次写回的合并统计
+ * @return int
+ */
+int nfs_cache_flush(int offset, int size, struct nfs_io_stat* stat) {
+    struct nfs_buf* buf;
+    int blk, first, last, cnt = 0, ret = NFS_ERROR_NONE;
+
+    if (stat != NULL) {
+        memset(stat, 0, sizeof(struct nfs_io_stat));
+    }
+    if (!nfs_cache_enabled() || nfs_cache.dirty_cnt == 0 || size <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    first = offset / NFS_BLK_SZ();
+    last  = (offset + size - 1) / NFS_BLK_SZ();
+    for (blk = first; blk <= last && ret == NFS_ERROR_NONE; blk++) {
+        buf = nfs_cache_lookup(blk);
+        if (buf != NULL && (buf->flags & NFS_FLAG_BUF_DIRTY)) {
+            ret = nfs_io_queue(blk, buf->data);
+            cnt++;
+        }
+    }
+    if (cnt == 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_io_end(stat) != NFS_ERROR_NONE || ret != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] write back failed\n", __func__);
+        return -NFS_ERROR_IO;
+    }
+    for (blk = first; blk <= last; blk++) {
+        buf = nfs_cache_lookup(blk);
+        if (buf != NULL && (buf->flags & NFS_FLAG_BUF_DIRTY)) {
+            buf->flags &= ~NFS_FLAG_BUF_DIRTY;
+            nfs_cache.dirty_cnt--;
+            nfs_cache.writebacks++;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
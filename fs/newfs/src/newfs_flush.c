@@ -0,0 +1,158 @@
+#include "../include/newfs.h"
+#include <time.h>
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 后台回写
+*
+* 脏inode先经nfs_sync_dirty写进块缓存，再由nfs_cache_sync落盘。回写线程在
+* 脏数据超过bg_bytes或最老的脏数据超过expire_ms时做一次完整回写；写者在
+* nfs_balance_dirty里发现超过max_bytes时自己回写，脏数据占的内存因此有上界，
+* 卸载时也只剩下最后一小段要刷。
+*
+* 脏数据量是真实字节数：脏inode的inode_d和已分配数据块（nfs_super.dirty_bytes，
+* 在nfs_mark_dirty和nfs_sync_inode里增减），标脏的超级块和位图，加上缓存脏块。
+*******************************************************************************/
+static struct nfs_flusher nfs_flusher;
+
+static int nfs_dirty_bytes() {
+    int bytes = nfs_super.dirty_bytes + NFS_BLKS_SZ(nfs_cache_dirty());
+
+    if (nfs_super.flags & NFS_FLAG_SUPER_DIRTY) {
+        bytes += sizeof(struct nfs_super_d);
+    }
+    if (nfs_super.flags & NFS_FLAG_MAP_INODE_DIRTY) {
+        bytes += NFS_BLKS_SZ(nfs_super.map_inode_blks);
+    }
+    if (nfs_super.flags & NFS_FLAG_MAP_DATA_DIRTY) {
+        bytes += NFS_BLKS_SZ(nfs_super.map_data_blks);
+    }
+    return bytes;
+}
+
+static void nfs_deadline(struct timespec* ts, int ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void* nfs_flusher_main(void* arg) {
+    struct timespec ts;
+    int interval = nfs_flusher.expire_ms < NFS_FLUSH_INTERVAL_MS ?
+                   nfs_flusher.expire_ms : NFS_FLUSH_INTERVAL_MS;
+
+    (void)arg;
+    NFS_LOCK();
+    while (!nfs_flusher.stop) {
+        nfs_deadline(&ts, interval);
+        pthread_cond_timedwait(&nfs_flusher.cond, &nfs_super.lock, &ts);
+        if (nfs_flusher.stop) {
+            break;
+        }
+        if (nfs_dirty_bytes() >= nfs_flusher.bg_bytes) {
+            nfs_flusher.bg_flushes++;
+            nfs_writeback();
+        }
+        else if (nfs_super.dirty_cnt > 0 &&
+                 nfs_now_ms() - nfs_super.dirty_since >= (uint64_t)nfs_flusher.expire_ms) {
+            nfs_flusher.expired_flushes++;
+            nfs_writeback();
+        }
+    }
+    NFS_UNLOCK();
+    return NULL;
+}
+
+uint64_t nfs_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/**
+ * @brief 把全部脏inode、超级块、位图和缓存脏块写到设备，需持有NFS_LOCK
+ *
+ * @return int
+ */
+int nfs_writeback() {
+    int ret = nfs_sync_dirty();
+
+    if (nfs_cache_sync(&nfs_flusher.last_io) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+    }
+    return ret;
+}
+/**
+ * @brief 启动回写线程，在nfs_mount成功后调用
+ *
+ * @param options 取其中的dirty_bytes、dirty_max_bytes、dirty_expire
+ * @return int
+ */
+int nfs_flusher_start(struct custom_options options) {
+    pthread_condattr_t attr;
+
+    memset(&nfs_flusher, 0, sizeof(struct nfs_flusher));
+    nfs_flusher.bg_bytes  = options.dirty_bytes > 0 ? options.dirty_bytes : NFS_DIRTY_BG_BYTES;
+    nfs_flusher.max_bytes = options.dirty_max_bytes > 0 ? options.dirty_max_bytes : NFS_DIRTY_MAX_BYTES;
+    nfs_flusher.expire_ms = options.dirty_expire > 0 ? options.dirty_expire : NFS_DIRTY_EXPIRE_MS;
+    if (nfs_flusher.max_bytes < nfs_flusher.bg_bytes) {
+        nfs_flusher.max_bytes = nfs_flusher.bg_bytes;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&nfs_flusher.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&nfs_flusher.tid, NULL, nfs_flusher_main, NULL) != 0) {
+        pthread_cond_destroy(&nfs_flusher.cond);
+        return -ENOMEM;
+    }
+    nfs_flusher.running = TRUE;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 停止回写线程，不能持有NFS_LOCK调用；剩下的脏数据由调用者刷
+ *
+ * @return void
+ */
+void nfs_flusher_stop() {
+    if (!nfs_flusher.running) {
+        return;
+    }
+    NFS_LOCK();
+    nfs_flusher.stop = TRUE;
+    pthread_cond_signal(&nfs_flusher.cond);
+    NFS_UNLOCK();
+    pthread_join(nfs_flusher.tid, NULL);
+    pthread_cond_destroy(&nfs_flusher.cond);
+    nfs_flusher.running = FALSE;
+    NFS_DBG("[%s] bg flushes %llu expired flushes %llu throttled %llu\n", __func__,
+            (unsigned long long)nfs_flusher.bg_flushes,
+            (unsigned long long)nfs_flusher.expired_flushes,
+            (unsigned long long)nfs_flusher.throttled);
+}
+/**
+ * @brief 修改类操作结束前调用，需持有NFS_LOCK
+ *
+ * 超过bg_bytes唤醒回写线程；超过max_bytes说明回写跟不上，由当前写者同步回写
+ * @return void
+ */
+void nfs_balance_dirty() {
+    int bytes;
+
+    if (!nfs_flusher.running) {
+        return;
+    }
+    bytes = nfs_dirty_bytes();
+    if (bytes >= nfs_flusher.max_bytes) {
+        nfs_flusher.throttled++;
+        nfs_writeback();
+    }
+    else if (bytes >= nfs_flusher.bg_bytes) {
+        pthread_cond_signal(&nfs_flusher.cond);
+    }
+}
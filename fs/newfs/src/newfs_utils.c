@@ -35,6 +35,102 @@ int nfs_calc_lvl(const char * path) {
     }
     return lvl;
 }
+/* 每个线程一块逻辑块大小的暂存区，只给不对齐的首尾块做读改写 */
+static pthread_key_t  nfs_stage_key;
+static pthread_once_t nfs_stage_once = PTHREAD_ONCE_INIT;
+
+static void nfs_stage_key_init() {
+    pthread_key_create(&nfs_stage_key, free);
+}
+
+static uint8_t* nfs_stage_get() {
+    uint8_t* stage;
+
+    pthread_once(&nfs_stage_once, nfs_stage_key_init);
+    stage = (uint8_t*)pthread_getspecific(nfs_stage_key);
+    if (stage == NULL) {
+        /* 块大小挂载后不再变化，分配一次即可 */
+        stage = (uint8_t*)malloc(NFS_BLK_SZ());
+        if (stage != NULL) {
+            pthread_setspecific(nfs_stage_key, stage);
+        }
+    }
+    return stage;
+}
+/**
+ * @brief 处理落在一个逻辑块内的不完整片段
+ * 
+ * @param offset_aligned 所在逻辑块的起始偏移
+ * @param bias 片段在块内的偏移
+ * @param content 
+ * @param size 片段长度，bias + size不超过一个逻辑块
+ * @param is_write 
+ * @return int 
+ */
+static int nfs_driver_edge(int offset_aligned, int bias, uint8_t *content, int size, boolean is_write) {
+    uint8_t* stage = nfs_stage_get();
+
+    if (stage == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    if (ddriver_pread(NFS_DRIVER(), (char *)stage, NFS_BLK_SZ(), offset_aligned) != NFS_BLK_SZ()) {
+        return -NFS_ERROR_IO;
+    }
+    if (!is_write) {
+        memcpy(content, stage + bias, size);
+        return NFS_ERROR_NONE;
+    }
+    memcpy(stage + bias, content, size);
+    if (ddriver_pwrite(NFS_DRIVER(), (char *)stage, NFS_BLK_SZ(), offset_aligned) != NFS_BLK_SZ()) {
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 不经缓存直接读写设备
+ * 
+ * 对齐的整块部分直接在调用者的缓冲区上一次ddriver_pread/pwrite，
+ * 只有首尾不完整的块才经暂存区读改写，不做额外分配
+ * @param offset 
+ * @param content 
+ * @param size 
+ * @param is_write 
+ * @return int 
+ */
+static int nfs_driver_io(int offset, uint8_t *content, int size, boolean is_write) {
+    int bias = offset % NFS_BLK_SZ();
+    int len;
+
+    if (size <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    // 1. 首块不对齐，或整段不足一块
+    if (bias != 0 || size < NFS_BLK_SZ()) {
+        len = NFS_BLK_SZ() - bias < size ? NFS_BLK_SZ() - bias : size;
+        if (nfs_driver_edge(offset - bias, bias, content, len, is_write) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        offset  += len;
+        content += len;
+        size    -= len;
+    }
+    // 2. 中间的整块，寻道由驱动内部模拟，不依赖fd的共享偏移
+    len = NFS_ROUND_DOWN(size, NFS_BLK_SZ());
+    if (len > 0) {
+        if (is_write ? ddriver_pwrite(NFS_DRIVER(), (char *)content, len, offset) != len
+                     : ddriver_pread(NFS_DRIVER(), (char *)content, len, offset) != len) {
+            return -NFS_ERROR_IO;
+        }
+        offset  += len;
+        content += len;
+        size    -= len;
+    }
+    // 3. 尾块剩下的部分
+    if (size > 0) {
+        return nfs_driver_edge(offset, 0, content, size, is_write);
+    }
+    return NFS_ERROR_NONE;
+}
 /**
  * @brief 驱动读
  * 
@@ -44,28 +140,10 @@ int nfs_calc_lvl(const char * path) {
  * @return int 
  */
 int nfs_driver_read(int offset, uint8_t *out_content, int size) {
-    // TODO
-    // 1. 根据传入的offset和size，确定要读取的数据段和512B对齐的下界down和上界up
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    
-    // 2. 利用ddriver_seek移动把磁盘头到down位置
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    
-    // 3. 然后用ddriver_read读取一个磁盘块，再移动磁盘头读取下一个磁盘块
-    while (size_aligned != 0)
-    {
-        ddriver_read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+    if (nfs_cache_enabled()) {
+        return nfs_cache_read(offset, out_content, size);
     }
-    // 4. 最后将从down到up的磁盘块都读取到内存中。然后拷贝所需要的部分，从bias处开始，大小为size，进行返回
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
-    return NFS_ERROR_NONE;
+    return nfs_driver_io(offset, out_content, size, FALSE);
 }
 /**
  * @brief 驱动写
@@ -76,33 +154,115 @@ int nfs_driver_read(int offset, uint8_t *out_content, int size) {
  * @return int 
  */
 int nfs_driver_write(int offset, uint8_t *in_content, int size) {
-    // TODO
-
-    // 1. 首先读
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    nfs_driver_read(offset_aligned, temp_content, size_aligned);
+    if (nfs_cache_enabled()) {
+        return nfs_cache_write(offset, in_content, size);
+    }
+    return nfs_driver_io(offset, in_content, size, TRUE);
+}
+/* 按块号递增排入的整块写，连续的并成一次ddriver_writev提交 */
+static struct nfs_io_stage nfs_io_stage;
 
+static int nfs_io_submit() {
+    struct nfs_io_stage* st = &nfs_io_stage;
+    off_t offset = NFS_BLKS_SZ(st->start_blk);
+    int   size   = NFS_BLKS_SZ(st->blk_cnt);
 
-    
-    // 2. 然后修改
-    memcpy(temp_content + bias, in_content, size);
-    
-    // 3. 最后写回
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+    if (st->blk_cnt == 0) {
+        return NFS_ERROR_NONE;
     }
-
-    free(temp_content);
+    st->blk_cnt = 0;
+    st->cur.runs++;
+    if (st->head == offset) {
+        st->cur.seeks_elided++;
+    }
+    else {
+        st->cur.seeks++;
+        if (ddriver_seek(NFS_DRIVER(), offset, SEEK_SET) != offset) {
+            st->head = -1;                             /* 游标位置未知，下次必定寻道 */
+            return -NFS_ERROR_SEEK;
+        }
+    }
+    if (ddriver_writev(NFS_DRIVER(), st->iov, size / NFS_BLK_SZ()) != size) {
+        st->head = -1;
+        return -NFS_ERROR_IO;
+    }
+    st->head = offset + size;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 设备刚打开，游标在0，清空待提交段和统计
+ * 
+ * @return void
+ */
+void nfs_io_reset() {
+    memset(&nfs_io_stage, 0, sizeof(struct nfs_io_stage));
+}
+/**
+ * @brief 排入一个整块写，data在nfs_io_end之前必须保持有效
+ * 
+ * 紧接当前段末尾的块并入该段，落在段内的块替换原来的数据，
+ * 其余情况先提交当前段再开新段
+ * @param blk 逻辑块号
+ * @param data 一个逻辑块的数据
+ * @return int 
+ */
+int nfs_io_queue(int blk, uint8_t *data) {
+    struct nfs_io_stage* st = &nfs_io_stage;
+    int ret;
+
+    st->cur.reqs++;
+    if (st->blk_cnt > 0 && blk >= st->start_blk && blk < st->start_blk + st->blk_cnt) {
+        st->cur.overlaps++;
+        st->iov[blk - st->start_blk].iov_base = data;
+        return NFS_ERROR_NONE;
+    }
+    if (st->blk_cnt > 0 && (blk != st->start_blk + st->blk_cnt || st->blk_cnt == NFS_IO_RUN_BLKS)) {
+        if ((ret = nfs_io_submit()) != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    if (st->blk_cnt == 0) {
+        st->start_blk = blk;
+    }
+    st->iov[st->blk_cnt].iov_base = data;
+    st->iov[st->blk_cnt].iov_len  = NFS_BLK_SZ();
+    st->blk_cnt++;
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief 提交剩余的段，结束一次回写，本次的合并统计并入累计值
+ * 
+ * @param stat 非NULL时返回本次回写的合并统计
+ * @return int 
+ */
+int nfs_io_end(struct nfs_io_stat* stat) {
+    struct nfs_io_stage* st = &nfs_io_stage;
+    int ret = nfs_io_submit();
+
+    st->total.reqs         += st->cur.reqs;
+    st->total.overlaps     += st->cur.overlaps;
+    st->total.runs         += st->cur.runs;
+    st->total.seeks        += st->cur.seeks;
+    st->total.seeks_elided += st->cur.seeks_elided;
+    if (stat != NULL) {
+        *stat = st->cur;
+    }
+    memset(&st->cur, 0, sizeof(struct nfs_io_stat));
+    return ret;
+}
+/**
+ * @brief 打印挂载以来的合并统计，卸载时调用一次
+ * 
+ * @return void
+ */
+void nfs_io_report() {
+    struct nfs_io_stat* st = &nfs_io_stage.total;
+
+    NFS_DBG("[%s] %llu blks (%llu overlapped) in %llu writes, %llu seeks, %llu seeks elided\n",
+            __func__, (unsigned long long)st->reqs, (unsigned long long)st->overlaps,
+            (unsigned long long)st->runs, (unsigned long long)st->seeks,
+            (unsigned long long)st->seeks_elided);
+}
 /**
  * @brief 将denry插入到inode中，采用头插法
  * 
@@ -130,6 +290,7 @@ int nfs_alloc_dentry(struct nfs_inode* inode, struct nfs_dentry* dentry) {
         inode->block_pointer[inode->block_allocted] = nfs_alloc_data();
         inode->block_allocted++;
     }
+    nfs_mark_dirty(inode, NFS_FLAG_INODE_DIRTY | NFS_FLAG_DATA_DIRTY);
     return inode->dir_cnt;
 }
 
@@ -179,6 +340,10 @@ struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
     inode->dir_cnt = 0;
     inode->block_allocted = 0;
     inode->dentrys = NULL;
+    inode->flags = 0;
+    inode->dirty_bytes = 0;
+    inode->dirty_next = NULL;
+    nfs_super.flags |= NFS_FLAG_MAP_INODE_DIRTY;
 
 
     // dentry指向分配的inode
@@ -192,6 +357,7 @@ struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
             inode->data[i] = (uint8_t *)malloc(NFS_BLK_SZ());
         }
     }
+    nfs_mark_dirty(inode, NFS_FLAG_INODE_DIRTY | NFS_FLAG_DATA_DIRTY);
     return inode;
 }
 /**
@@ -224,86 +390,161 @@ struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
         return -NFS_ERROR_NOSPACE;
     }
 
+    nfs_super.flags |= NFS_FLAG_MAP_DATA_DIRTY;
     return dno_cursor;
  }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 归还一个数据块，与nfs_alloc_data的位序一致
+ * @param dno 数据块号
+ * @return void
+ */
+void nfs_free_data(int dno) {
+    nfs_super.map_data[dno / UINT8_BITS] &= (uint8_t)(~(0x1 << (dno % UINT8_BITS)));
+    nfs_super.flags |= NFS_FLAG_MAP_DATA_DIRTY;
+}
+/**
+ * @brief 标记inode的哪些部分需要写回，并挂到脏链上
  * 
+ * 改动子dentry（增删、改名）时标记父目录的NFS_FLAG_DATA_DIRTY
  * @param inode 
- * @return int 
+ * @param flags NFS_FLAG_INODE_DIRTY和/或NFS_FLAG_DATA_DIRTY
+ * @return void
  */
-int nfs_sync_inode(struct nfs_inode * inode) {
+/* inode_d一条加上标脏时全部已分配的数据块，与nfs_sync_inode写出的量一致 */
+static void nfs_account_dirty(struct nfs_inode * inode) {
+    int bytes = 0;
+
+    if (inode->flags & NFS_FLAG_INODE_DIRTY) {
+        bytes += sizeof(struct nfs_inode_d);
+    }
+    if (inode->flags & NFS_FLAG_DATA_DIRTY) {
+        bytes += NFS_BLKS_SZ(inode->block_allocted);
+    }
+    nfs_super.dirty_bytes += bytes - inode->dirty_bytes;
+    inode->dirty_bytes     = bytes;
+}
+
+void nfs_mark_dirty(struct nfs_inode * inode, flag16 flags) {
+    inode->flags |= flags;
+    nfs_account_dirty(inode);
+    if (!(inode->flags & NFS_FLAG_ON_DIRTY_LIST)) {
+        if (nfs_super.dirty_cnt++ == 0) {
+            nfs_super.dirty_since = nfs_now_ms();
+        }
+        inode->flags     |= NFS_FLAG_ON_DIRTY_LIST;
+        inode->dirty_next = nfs_super.dirty_inodes;
+        nfs_super.dirty_inodes = inode;
+    }
+}
+
+/* inode即将释放，从脏链上摘下 */
+static void nfs_forget_dirty(struct nfs_inode * inode) {
+    struct nfs_inode** link = &nfs_super.dirty_inodes;
+
+    nfs_super.dirty_bytes -= inode->dirty_bytes;
+    inode->dirty_bytes     = 0;
+    if (!(inode->flags & NFS_FLAG_ON_DIRTY_LIST)) {
+        return;
+    }
+    while (*link != inode) {
+        link = &(*link)->dirty_next;
+    }
+    *link = inode->dirty_next;
+    inode->dirty_next = NULL;
+    inode->flags = 0;
+    nfs_super.dirty_cnt--;
+}
+/* 写索引节点 struct inode_d */
+static int nfs_sync_inode_d(struct nfs_inode * inode) {
     struct nfs_inode_d  inode_d;
-    struct nfs_dentry*  dentry_cursor;
-    struct nfs_dentry_d dentry_d;
-    int offset;
     int ino             = inode->ino;
 
-    
-    // 把inode复制到inode_d
-    inode_d.ino            = ino;
-    inode_d.size           = inode->size;
-    inode_d.ftype          = inode->dentry->ftype;
-    inode_d.dir_cnt        = inode->dir_cnt;
-    inode_d.block_allocted = inode->block_allocted;
+    if (inode->flags & NFS_FLAG_INODE_DIRTY) {
+        // 把inode复制到inode_d
+        inode_d.ino            = ino;
+        inode_d.size           = inode->size;
+        inode_d.ftype          = inode->dentry->ftype;
+        inode_d.dir_cnt        = inode->dir_cnt;
+        inode_d.block_allocted = inode->block_allocted;
 
-    for(int i = 0; i < NFS_DATA_PER_FILE; i++){
-        inode_d.block_pointer[i] = inode->block_pointer[i];
+        for(int i = 0; i < NFS_DATA_PER_FILE; i++){
+            inode_d.block_pointer[i] = inode->block_pointer[i];
+        }
+
+        if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        inode->flags &= ~NFS_FLAG_INODE_DIRTY;
+        nfs_account_dirty(inode);
     }
+    return NFS_ERROR_NONE;
+}
 
-    /* 1. 先写传入文件的 索引节点 struct inode_d */
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
-        return -NFS_ERROR_IO;
+/* 写文件数据 data，目录文件的data就是所有子文件的 目录项 struct dentry_d */
+static int nfs_sync_inode_data(struct nfs_inode * inode) {
+    struct nfs_dentry*  dentry_cursor;
+
+    if (!(inode->flags & NFS_FLAG_DATA_DIRTY)) {
+        return NFS_ERROR_NONE;
     }
-    //TODO
-    /* 然后再写这个文件的文件数据 data
-    （特别的，写目录文件的文件数据data就是在写回所有子文件的 目录项 struct dentry_d），
-    对于目录文件还会额外 递归进入每个子文件，从而完成全部文件的写回 */
+    if (NFS_IS_DIR(inode)) {
+        struct nfs_dentry_d* blk_d;
+        int blk_number = 0;
+        int i;
 
-    
-    if (NFS_IS_DIR(inode)) {    //为目录，递归处理
-        
-        int blk_number = 0;                      
+        blk_d = (struct nfs_dentry_d*)malloc(NFS_BLK_SZ());
+        if (blk_d == NULL) {
+            return -NFS_ERROR_NOSPACE;
+        }
         dentry_cursor = inode->dentrys;
 
-        /* 将dentry写回*/
+        /* 在内存里拼好整块dentry_d，每块只写一次 */
         while(dentry_cursor != NULL && blk_number < inode->block_allocted){
-            offset = NFS_DATA_OFS(inode->block_pointer[blk_number]);
-            while ((dentry_cursor != NULL) && (offset + sizeof(struct nfs_dentry_d) < NFS_DATA_OFS(inode->block_pointer[blk_number] + 1)))
-            {
-                /* 将dentry复制到dentry_d */
-                memcpy(dentry_d.fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                if (nfs_driver_write(offset, (uint8_t *)&dentry_d, sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return -NFS_ERROR_IO;                     
-                }
-                
-                /* 递归调用 */
-                if (dentry_cursor->inode != NULL) {
-                    nfs_sync_inode(dentry_cursor->inode);
-                }
-
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct nfs_dentry_d);
+            memset(blk_d, 0, NFS_BLK_SZ());
+            for (i = 0; dentry_cursor != NULL && i < NFS_DENTRY_D_PER_BLK(); i++) {
+                memcpy(blk_d[i].fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
+                blk_d[i].ftype = dentry_cursor->ftype;
+                blk_d[i].ino   = dentry_cursor->ino;
+                dentry_cursor  = dentry_cursor->brother;
+            }
+            if (nfs_driver_write(NFS_DATA_OFS(inode->block_pointer[blk_number]), (uint8_t *)blk_d,
+                                 NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+                NFS_DBG("[%s] io error\n", __func__);
+                free(blk_d);
+                return -NFS_ERROR_IO;
             }
             blk_number++;
         }
+        free(blk_d);
     }
-    /* 如果是文件类型，直接写回 */
+    /* 如果是文件类型，直接写回，data[i]对应block_pointer[i]这一个块 */
     else if (NFS_IS_REG(inode)) {
         for(int i = 0; i < inode->block_allocted; i++){
-            if (nfs_driver_write(NFS_DATA_OFS(inode->block_pointer[i]), inode->data[i], NFS_BLKS_SZ(NFS_DATA_PER_FILE)) != NFS_ERROR_NONE) {
+            if (nfs_driver_write(NFS_DATA_OFS(inode->block_pointer[i]), inode->data[i], NFS_BLK_SZ()) != NFS_ERROR_NONE) {
                 NFS_DBG("[%s] io error\n", __func__);
                 return -NFS_ERROR_IO;
             }
         }
     }
+    inode->flags &= ~NFS_FLAG_DATA_DIRTY;
+    nfs_account_dirty(inode);
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief 将一个inode中标脏的部分刷回磁盘，不递归子目录
+ * 
+ * 先写数据再写inode_d，inode_d里的块号不会先于块内容落盘
+ * @param inode 
+ * @return int 
+ */
+int nfs_sync_inode(struct nfs_inode * inode) {
+    if (nfs_sync_inode_data(inode) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    return nfs_sync_inode_d(inode);
+}
 
 /**
  * @brief 
@@ -316,7 +557,6 @@ struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
     struct nfs_inode* inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
     struct nfs_inode_d inode_d;
     struct nfs_dentry* sub_dentry;
-    struct nfs_dentry_d dentry_d;
     int    dir_cnt = 0;
     /* 从磁盘读索引结点到inode_d */
     if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
@@ -332,45 +572,59 @@ struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
     inode->dentry = dentry;
     inode->dentrys = NULL;
     inode->block_allocted = inode_d.block_allocted;
+    inode->flags = 0;
+    inode->dirty_bytes = 0;
+    inode->dirty_next = NULL;
     for(int i = 0; i < NFS_DATA_PER_FILE; i++){
         inode->block_pointer[i] = inode_d.block_pointer[i];
     }
     //TODO
     /* 内存中的inode的数据或子目录项部分也需要读出 */
     if (NFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
+        struct nfs_dentry_d* blk_d;
+        struct nfs_dentry**  tail = &inode->dentrys;
         int blk_number = 0;
-        int offset;
+        int i;
 
-        /*处理每一个目录项*/
-        while(dir_cnt > 0 && blk_number < NFS_DATA_PER_FILE){
-            offset = NFS_DATA_OFS(inode->block_pointer[blk_number]);
+        blk_d = (struct nfs_dentry_d*)malloc(NFS_BLK_SZ());
+        if (blk_d == NULL) {
+            return NULL;
+        }
+        dir_cnt = inode_d.dir_cnt;
 
-            // 当从磁盘读入时，由于磁盘中没有链表指针，因此只能通过一个dentry_d大小来进行遍历
-            while((dir_cnt > 0) && (offset + sizeof(struct nfs_dentry_d) < NFS_DATA_OFS(inode->block_pointer[blk_number] + 1))){
-                if (nfs_driver_read(offset, (uint8_t *)&dentry_d, sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE){
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return NULL;  
-                }
-                
+        /* 每个目录块读一次，再逐个解析其中的dentry_d */
+        while(dir_cnt > 0 && blk_number < inode->block_allocted){
+            if (nfs_driver_read(NFS_DATA_OFS(inode->block_pointer[blk_number]), (uint8_t *)blk_d,
+                                NFS_BLK_SZ()) != NFS_ERROR_NONE) {
+                NFS_DBG("[%s] io error\n", __func__);
+                free(blk_d);
+                return NULL;
+            }
+            for (i = 0; dir_cnt > 0 && i < NFS_DENTRY_D_PER_BLK(); i++) {
                 /* 用从磁盘中读出的dentry_d更新内存中的sub_dentry */
-                sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
+                sub_dentry = new_dentry(blk_d[i].fname, blk_d[i].ftype);
                 sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                nfs_alloc_dentry(inode, sub_dentry);
+                sub_dentry->ino    = blk_d[i].ino;
 
-                offset += sizeof(struct nfs_dentry_d);
+                /* 块已经在磁盘上分配好了，不走nfs_alloc_dentry，按磁盘顺序挂到链尾 */
+                *tail = sub_dentry;
+                tail  = &sub_dentry->brother;
+                inode->dir_cnt++;
                 dir_cnt--;
             }
             blk_number++;
         }
+        free(blk_d);
     }
     /*如果inode是文件类型，则直接读取数据即可*/
     else if (NFS_IS_REG(inode)) {
         for (int i = 0; i < NFS_DATA_PER_FILE; i++) {
-            inode->data[i] = (uint8_t *)malloc(NFS_BLKS_SZ(NFS_DATA_PER_FILE));
+            inode->data[i] = (uint8_t *)calloc(1, NFS_BLK_SZ());
+            if (i >= inode->block_allocted) {
+                continue;                              /* 还没分配的块留空，写时再用 */
+            }
             if (nfs_driver_read(NFS_DATA_OFS(inode->block_pointer[i]), (uint8_t *)inode->data[i], 
-                            NFS_BLKS_SZ(NFS_DATA_PER_FILE)) != NFS_ERROR_NONE) {
+                            NFS_BLK_SZ()) != NFS_ERROR_NONE) {
                 NFS_DBG("[%s] io error\n", __func__);
                 return NULL;                    
             }
@@ -431,7 +685,7 @@ struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_r
     int   lvl = 0;
     boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy = (char*)malloc(strlen(path) + 1);
     *is_root = FALSE;
     strcpy(path_cpy, path);
 
@@ -446,7 +700,7 @@ struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_r
     {   
         lvl++;
         if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
         }
 
         inode = dentry_cursor->inode;
@@ -521,8 +775,19 @@ int nfs_mount(struct custom_options options){
     
     int                 super_blks;
     boolean             is_init = FALSE;
+    pthread_mutexattr_t lock_attr;
 
     nfs_super.is_mounted = FALSE;
+    nfs_super.flags = 0;
+    nfs_super.dirty_inodes = NULL;
+    nfs_super.dirty_cnt = 0;
+    nfs_super.dirty_bytes = 0;
+
+    /* 操作之间可能嵌套调用（rename调mknod，rmdir调unlink），用递归锁 */
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_settype(&lock_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&nfs_super.lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
 
     driver_fd = ddriver_open(options.device);
 
@@ -535,7 +800,15 @@ int nfs_mount(struct custom_options options){
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &nfs_super.sz_disk);
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &nfs_super.sz_io);
     nfs_super.sz_blks = 2 * nfs_super.sz_io; 
-
+    nfs_io_reset();
+
+    // 块大小确定后再建缓存，之后的nfs_driver_read/write都经过它
+    ret = nfs_cache_init(options.nocache ? 0 :
+                         options.cache_blks > 0 ? options.cache_blks : NFS_CACHE_BLKS);
+    if (ret != NFS_ERROR_NONE) {
+        ddriver_close(driver_fd);
+        return ret;
+    }
 
     // 新建根目录
     root_dentry = new_dentry("/", NFS_DIR);     
@@ -567,6 +840,7 @@ int nfs_mount(struct custom_options options){
 
         nfs_super_d.sz_usage            = 0;
         nfs_super_d.magic_num           = NFS_MAGIC_NUM;
+        nfs_super.flags                |= NFS_FLAG_SUPER_DIRTY | NFS_FLAG_MAP_INODE_DIRTY | NFS_FLAG_MAP_DATA_DIRTY;
         is_init = TRUE;
     }
 
@@ -595,7 +869,8 @@ int nfs_mount(struct custom_options options){
 
     if (is_init) {                                    /* 分配根节点 */
         root_inode = nfs_alloc_inode(root_dentry);
-        nfs_sync_inode(root_inode);
+        nfs_sync_dirty();                             /* 连同超级块和位图一起落盘 */
+        free(root_inode);                             /* 下面按磁盘内容重新读入 */
     }
     
     root_inode            = nfs_read_inode(root_dentry, NFS_ROOT_INO);
@@ -603,112 +878,263 @@ int nfs_mount(struct custom_options options){
     nfs_super.root_dentry = root_dentry;
     nfs_super.is_mounted  = TRUE;
 
+    ret = nfs_flusher_start(options);
     return ret;
 }
+/* 写标脏的超级块和两张位图 */
+static int nfs_sync_super() {
+    struct nfs_super_d  nfs_super_d; 
+
+    if (nfs_super.flags & NFS_FLAG_SUPER_DIRTY) {
+        nfs_super_d.magic_num           = NFS_MAGIC_NUM;
+        nfs_super_d.sz_usage            = nfs_super.sz_usage;
+
+        nfs_super_d.map_inode_blks      = nfs_super.map_inode_blks;
+        nfs_super_d.map_inode_offset    = nfs_super.map_inode_offset;
+        nfs_super_d.inode_offset        = nfs_super.inode_offset;
+        
+        nfs_super_d.map_data_blks       = nfs_super.map_data_blks;
+        nfs_super_d.map_data_offset     = nfs_super.map_data_offset;
+        nfs_super_d.data_offset         = nfs_super.data_offset;
+
+        if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
+                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        nfs_super.flags &= ~NFS_FLAG_SUPER_DIRTY;
+    }
+
+    if (nfs_super.flags & NFS_FLAG_MAP_INODE_DIRTY) {
+        if (nfs_driver_write(nfs_super.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
+                             NFS_BLKS_SZ(nfs_super.map_inode_blks)) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        nfs_super.flags &= ~NFS_FLAG_MAP_INODE_DIRTY;
+    }
+
+    if (nfs_super.flags & NFS_FLAG_MAP_DATA_DIRTY) {
+        if (nfs_driver_write(nfs_super.map_data_offset, (uint8_t *)(nfs_super.map_data), 
+                             NFS_BLKS_SZ(nfs_super.map_data_blks)) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        nfs_super.flags &= ~NFS_FLAG_MAP_DATA_DIRTY;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/* 设备屏障：之前写的块先于之后的写落到介质 */
+static int nfs_fsync_barrier() {
+    return ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_FLUSH, NULL) < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+
+/* 只刷inode自己的数据块，每个块号一个块，与nfs_sync_inode写的范围一致 */
+static int nfs_fsync_inode_blks(struct nfs_inode * inode) {
+    int i;
+
+    for (i = 0; i < inode->block_allocted; i++) {
+        if (nfs_cache_flush(NFS_DATA_OFS(inode->block_pointer[i]), NFS_BLK_SZ(), NULL) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
 /**
- * @brief 
+ * @brief 只让一个文件持久化，不碰其他脏inode
  * 
+ * 分三步，每步之后下发设备屏障：
+ *  1) 文件数据块
+ *  2) 超级块、位图，以及inode_d（其中的块号已经在盘上）
+ *  3) 父目录的目录块和inode_d（其中的目录项指向的inode已经在盘上）
+ * 已经被后台回写搬进缓存、但还没落盘的块也一并写出。
+ * @param inode 
  * @return int 
  */
-int nfs_umount() {
-    // TODO
-    // 相比sfs也只是多加了数据位图相关操作
-    
-    
-    struct nfs_super_d  nfs_super_d; 
+int nfs_fsync_inode(struct nfs_inode * inode) {
+    struct nfs_inode* parent = inode->dentry->parent != NULL ? inode->dentry->parent->inode : NULL;
 
-    if (!nfs_super.is_mounted) {
-        return NFS_ERROR_NONE;
+    // 1. 数据
+    if (nfs_sync_inode_data(inode) != NFS_ERROR_NONE ||
+        nfs_fsync_inode_blks(inode) != NFS_ERROR_NONE ||
+        nfs_fsync_barrier() != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
     }
 
-    // 刷回索引及其指向的data
-    nfs_sync_inode(nfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
-    nfs_super_d.magic_num           = NFS_MAGIC_NUM;
-    nfs_super_d.sz_usage            = nfs_super.sz_usage;
-
-    nfs_super_d.map_inode_blks      = nfs_super.map_inode_blks;
-    nfs_super_d.map_inode_offset    = nfs_super.map_inode_offset;
-    nfs_super_d.inode_offset        = nfs_super.inode_offset;
-    
-    
-    nfs_super_d.map_data_blks       = nfs_super.map_data_blks;
-    nfs_super_d.map_data_offset     = nfs_super.map_data_offset;
-    nfs_super_d.data_offset         = nfs_super.data_offset;
+    // 2. 位图和inode_d
+    if (nfs_sync_super() != NFS_ERROR_NONE ||
+        nfs_sync_inode_d(inode) != NFS_ERROR_NONE ||
+        nfs_cache_flush(NFS_SUPER_OFS, NFS_BLK_SZ(), NULL) != NFS_ERROR_NONE ||
+        nfs_cache_flush(nfs_super.map_inode_offset, NFS_BLKS_SZ(nfs_super.map_inode_blks), NULL) != NFS_ERROR_NONE ||
+        nfs_cache_flush(nfs_super.map_data_offset, NFS_BLKS_SZ(nfs_super.map_data_blks), NULL) != NFS_ERROR_NONE ||
+        nfs_cache_flush(NFS_INO_OFS(inode->ino), sizeof(struct nfs_inode_d), NULL) != NFS_ERROR_NONE ||
+        nfs_fsync_barrier() != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
 
-    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
-                     sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+    // 3. 父目录，根目录没有
+    if (parent == NULL || parent == inode) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_sync_inode(parent) != NFS_ERROR_NONE ||
+        nfs_fsync_inode_blks(parent) != NFS_ERROR_NONE ||
+        nfs_cache_flush(NFS_INO_OFS(parent->ino), sizeof(struct nfs_inode_d), NULL) != NFS_ERROR_NONE ||
+        nfs_fsync_barrier() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 只写回脏链上的inode，以及标脏的超级块和位图
+ * 
+ * @return int 
+ */
+int nfs_sync_dirty() {
+    struct nfs_inode*   inode;
+    struct nfs_inode*   failed = NULL;
+    int                 ret = NFS_ERROR_NONE;
 
-    if (nfs_driver_write(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
-                         NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
+    while ((inode = nfs_super.dirty_inodes) != NULL) {
+        nfs_super.dirty_inodes = inode->dirty_next;
+        nfs_super.dirty_cnt--;
+        inode->dirty_next = NULL;
+        inode->flags &= ~NFS_FLAG_ON_DIRTY_LIST;
+        if (nfs_sync_inode(inode) != NFS_ERROR_NONE) {
+            inode->dirty_next = failed;
+            failed = inode;
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    while ((inode = failed) != NULL) {                /* 写失败的留在脏链上，下次再试 */
+        failed = inode->dirty_next;
+        nfs_mark_dirty(inode, 0);
+    }
+
+    if (nfs_sync_super() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
+    return ret;
+}
+/**
+ * @brief 
+ * 
+ * @return int 
+ */
+int nfs_umount() {
+    // TODO
+    // 相比sfs也只是多加了数据位图相关操作
+
+    if (!nfs_super.is_mounted) {
+        return NFS_ERROR_NONE;
+    }
 
-    if (nfs_driver_write(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
-                         NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+    // 先停回写线程，再刷回剩下改动过的索引、数据、超级块和位图
+    nfs_flusher_stop();
+    if (nfs_sync_dirty() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
     free(nfs_super.map_inode);
     free(nfs_super.map_data);
+    nfs_cache_destroy();                            /* 写回剩余脏块 */
+    nfs_io_report();
     ddriver_close(NFS_DRIVER());
+    pthread_mutex_destroy(&nfs_super.lock);
 
     return NFS_ERROR_NONE;
 }
 
 
-int nfs_write_file(struct nfs_inode* inode, const char* data, int length, int offset) {
-    if (inode->size < (NFS_ROUND_UP(offset + length, NFS_BLK_SZ()) / NFS_BLK_SZ())) {
-        int nums = (NFS_ROUND_UP(offset + length, NFS_BLK_SZ()) / NFS_BLK_SZ()) - inode->size;
-        for (int i = 0; i < nums; i ++) {
-            inode->block_pointer[inode->size ++] = nfs_alloc_data();
-            if (inode->data[i]) {
-                char* initial_data = inode->data[i];
-                inode->data[i] = (uint8_t*)malloc(NFS_BLK_SZ());
-                memcpy(inode->data[i], initial_data, NFS_BLKS_SZ(inode->size - nums));
-                free(initial_data);
-            } else {
-                inode->data[i] = (uint8_t*)malloc(NFS_BLK_SZ());
-                memset(inode->data[i], 0, NFS_BLK_SZ());
-            }
+/* 把[pos, pos + len)按块拷进data[]，每个data[i]只有一个块大；src为NULL时填零 */
+static void nfs_file_fill(struct nfs_inode* inode, int pos, const char* src, int len) {
+    int blk_ofs, n;
+
+    while (len > 0) {
+        blk_ofs = pos % NFS_BLK_SZ();
+        n = NFS_BLK_SZ() - blk_ofs < len ? NFS_BLK_SZ() - blk_ofs : len;
+        if (src != NULL) {
+            memcpy(inode->data[pos / NFS_BLK_SZ()] + blk_ofs, src, n);
+            src += n;
+        }
+        else {
+            memset(inode->data[pos / NFS_BLK_SZ()] + blk_ofs, 0, n);
         }
+        pos += n;
+        len -= n;
     }
-
-    if (data != NULL)
-	    memcpy(inode->data[0] + offset, data, length);
 }
+/**
+ * @brief 写文件，data为NULL时把文件大小改为offset + length（truncate）
+ * 
+ * 普通文件的size是字节数，block_allocted是已分配的数据块数，与目录一致
+ * @param inode 
+ * @param data 
+ * @param length 
+ * @param offset 
+ * @return int 写入的字节数
+ */
+int nfs_write_file(struct nfs_inode* inode, const char* data, int length, int offset) {
+    int end  = offset + length;
+    int blks = NFS_ROUND_UP(end, NFS_BLK_SZ()) / NFS_BLK_SZ();
+    int dno;
 
-int nfs_read_file(struct nfs_inode* inode, char* data, int length, int offset) {
-    if (offset >= inode->size * NFS_BLK_SZ()) {
-        // Offset is out of bounds
-        return 0;
+    if (blks > NFS_DATA_PER_FILE) {
+        return -NFS_ERROR_NOSPACE;
     }
-
-    int bytes_read = 0;
-    int start_block = offset / NFS_BLK_SZ();
-    int start_offset = offset % NFS_BLK_SZ();
-
-    while (bytes_read < length && start_block < inode->size) {
-        int remaining_length = length - bytes_read;
-        int bytes_in_block = NFS_BLK_SZ() - start_offset;
-        int bytes_to_read = remaining_length < bytes_in_block ? remaining_length : bytes_in_block;
-
-        if (inode->data[start_block] == NULL) {
-            // Block has not been allocated, treat as zeros
-            memset(data + bytes_read, 0, bytes_to_read);
-        } else {
-            memcpy(data + bytes_read, inode->data[start_block] + start_offset, bytes_to_read);
+    while (inode->block_allocted < blks) {          /* 新块从零开始 */
+        dno = nfs_alloc_data();
+        if (dno < 0) {
+            return dno;
         }
+        inode->block_pointer[inode->block_allocted] = dno;
+        memset(inode->data[inode->block_allocted], 0, NFS_BLK_SZ());
+        inode->block_allocted++;
+    }
 
-        bytes_read += bytes_to_read;
-        start_block++;
-        start_offset = 0; // After the first block, subsequent reads start from offset 0
+    /* 文件尾到写入位置之间补零，缩小后还留在块里的旧内容也一并清掉 */
+    if (data == NULL) {
+        if (end > inode->size) {
+            nfs_file_fill(inode, inode->size, NULL, end - inode->size);
+        }
+        inode->size = end;
     }
+    else {
+        if (offset > inode->size) {
+            nfs_file_fill(inode, inode->size, NULL, offset - inode->size);
+        }
+        nfs_file_fill(inode, offset, data, length);
+        if (end > inode->size) {
+            inode->size = end;
+        }
+    }
+    nfs_mark_dirty(inode, NFS_FLAG_INODE_DIRTY | NFS_FLAG_DATA_DIRTY);
+    return length;
+}
+/**
+ * @brief 读文件，不超过文件尾
+ * 
+ * @param inode 
+ * @param data 
+ * @param length 
+ * @param offset 
+ * @return int 读到的字节数
+ */
+int nfs_read_file(struct nfs_inode* inode, char* data, int length, int offset) {
+    int bytes_read = 0;
+    int blk_ofs, n;
 
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (length > inode->size - offset) {
+        length = inode->size - offset;
+    }
+    while (bytes_read < length) {
+        blk_ofs = offset % NFS_BLK_SZ();
+        n = NFS_BLK_SZ() - blk_ofs < length - bytes_read ? NFS_BLK_SZ() - blk_ofs : length - bytes_read;
+        memcpy(data + bytes_read, inode->data[offset / NFS_BLK_SZ()] + blk_ofs, n);
+        bytes_read += n;
+        offset     += n;
+    }
     return bytes_read;
-
 }
 
 
@@ -736,6 +1162,7 @@ int nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry) {
         return -NFS_ERROR_NOTFOUND;
     }
     inode->dir_cnt--;
+    nfs_mark_dirty(inode, NFS_FLAG_INODE_DIRTY | NFS_FLAG_DATA_DIRTY);
     return inode->dir_cnt;
 }
 
@@ -775,7 +1202,7 @@ int nfs_drop_inode(struct nfs_inode * inode) {
     int byte_cursor = 0; 
     int bit_cursor  = 0; 
     int ino_cursor  = 0;
-    int data_cursor = 0;
+    int i;
     boolean is_find = FALSE;
 
     if (inode == nfs_super.root_dentry->inode) {
@@ -788,6 +1215,10 @@ int nfs_drop_inode(struct nfs_inode * inode) {
         while (dentry_cursor)
         {   
             inode_cursor = dentry_cursor->inode;
+            if (inode_cursor == NULL) {               /* 重新挂载后没访问过的子文件，先读出块号才能归还 */
+                inode_cursor = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+                dentry_cursor->inode = inode_cursor;
+            }
             nfs_drop_inode(inode_cursor);
             nfs_drop_dentry(inode, dentry_cursor);
             dentry_to_free = dentry_cursor;
@@ -812,24 +1243,17 @@ int nfs_drop_inode(struct nfs_inode * inode) {
         }
     }
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); 
-        byte_cursor++)                            /* 调整inodemap */
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if (data_cursor == inode->ino) {
-                    nfs_super.map_data[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                    is_find = TRUE;
-                    break;
-            }
-            data_cursor++;
-        }
-        if (is_find == TRUE) {
-            break;
-        }
+    for (i = 0; i < inode->block_allocted; i++) {   /* 调整datamap，按块号逐个归还 */
+        nfs_free_data(inode->block_pointer[i]);
     }
 
-    if (inode->data)
-        free(inode->data);
+    nfs_super.flags |= NFS_FLAG_MAP_INODE_DIRTY | NFS_FLAG_MAP_DATA_DIRTY;
+    nfs_forget_dirty(inode);
+    if (NFS_IS_REG(inode)) {                        /* 普通文件的块缓冲在分配inode时一次性malloc */
+        for (i = 0; i < NFS_DATA_PER_FILE; i++) {
+            free(inode->data[i]);
+        }
+    }
     free(inode);
 
     return NFS_ERROR_NONE;
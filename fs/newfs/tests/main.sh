@@ -2,9 +2,9 @@
 POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
-# mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+# mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh) (writeback.sh flusher.sh fsync.sh cache.sh rm_mv.sh)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh writeback.sh flusher.sh fsync.sh cache.sh rm_mv.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 2 1 1 6 3)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +35,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 数据写回测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh writeback.sh flusher.sh fsync.sh cache.sh rm_mv.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -95,8 +99,9 @@ function fail() {
 }
 
 # Utils
+# 额外参数原样传给文件系统，如 mount_fuse --cache_blks=4
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "$@" "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -107,6 +112,14 @@ function check_mount() {
     return 0
 }
 
+# 模拟守护进程崩溃：直接杀掉，不经过umount写回，再清掉失效的挂载点
+function kill_fuse() {
+    pkill -9 -x "${PROJECT_NAME}"
+    sleep 1
+    fusermount -u "${MNTPOINT}" 2>/dev/null
+    clean_mount
+}
+
 function try_mount_or_fail() {
     if ! check_mount; then
         mount_fuse
@@ -0,0 +1,59 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - cache eviction"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+# 每个文件内容不同，第N个文件重复N+4行，跨2~3个数据块
+function golden_of () {
+    _IDX=$1
+    for _ in $(seq 1 $((_IDX + 4))); do
+        echo "$_IDX: $GOLDEN"
+    done
+}
+
+function check_golden () {
+    _FILE=$1
+    _TEST_CASE=$2
+    _IDX=${_FILE##*file}
+
+    if [[ "$(cat "$_FILE")" != "$(golden_of "$_IDX")" ]]; then
+        fail "$_TEST_CASE: 读文件$_FILE成功, 但内容与写入的不同, 请检查缓存换出时是否写回脏块"
+        return 1
+    fi
+    return 0
+}
+
+function mount_small_cache () {
+    if ! mount_fuse --cache_blks=2 || ! check_mount; then
+        fail "$TEST_CASE: 带--cache_blks参数挂载失败"
+        exit 1
+    fi
+}
+
+clean_mount
+clean_ddriver
+
+# 缓存只有2个块，写3个多块文件一定会换出脏块
+mount_small_cache
+
+for i in 0 1 2; do
+    touch_and_check "${MNTPOINT}"/file$i
+    golden_of $i | tee "${MNTPOINT}"/file$i > /dev/null
+done
+
+for i in 0 1 2; do
+    TEST_CASE="case 11.$((i + 1)) - read ${MNTPOINT}/file$i with --cache_blks=2"
+    core_tester ls "${MNTPOINT}"/file$i check_golden "$TEST_CASE"
+done
+
+clean_mount
+mount_small_cache
+
+for i in 0 1 2; do
+    TEST_CASE="case 11.$((i + 4)) - read ${MNTPOINT}/file$i after remount"
+    core_tester ls "${MNTPOINT}"/file$i check_golden "$TEST_CASE"
+done
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - background writeback"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+function check_flushed () {
+    _FILE=$1
+    _TEST_CASE=$2
+
+    if [[ ! -f "$_FILE" ]]; then
+        fail "$_TEST_CASE: 重新挂载后找不到$_FILE, 回写线程没有在超时后写回"
+        return 1
+    fi
+    if [[ "$(cat "$_FILE")" != "$GOLDEN" ]]; then
+        fail "$_TEST_CASE: 读文件$_FILE成功, 但内容与写入的不同, 回写线程没有写回数据块"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+# 脏数据500ms后过期，回写线程应在杀掉守护进程前把它写回
+if ! mount_fuse --dirty_expire=500 || ! check_mount; then
+    fail "$TEST_CASE: 带--dirty_expire参数挂载失败"
+    exit 1
+fi
+
+touch_and_check "${MNTPOINT}"/file0
+echo "$GOLDEN" | tee "${MNTPOINT}"/file0 > /dev/null
+
+sleep 3
+kill_fuse
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - read ${MNTPOINT}/file0 after crash"
+core_tester ls "${MNTPOINT}"/file0 check_flushed "$TEST_CASE"
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - fsync"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+# 8行约3.5KB，跨4个数据块
+function golden_long () {
+    for _ in 1 2 3 4 5 6 7 8; do
+        echo "$GOLDEN"
+    done
+}
+
+function check_fsynced () {
+    _FILE=$1
+    _TEST_CASE=$2
+
+    if [[ ! -f "$_FILE" ]]; then
+        fail "$_TEST_CASE: 重新挂载后找不到$_FILE, fsync没有写回目录项"
+        return 1
+    fi
+    if [[ "$(cat "$_FILE")" != "$(golden_long)" ]]; then
+        fail "$_TEST_CASE: 读文件$_FILE成功, 但内容与写入的不同, fsync没有写回数据块"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+# 脏数据10分钟才过期，回写线程不会先写回，落盘只能靠fsync
+if ! mount_fuse --dirty_expire=600000 || ! check_mount; then
+    fail "$TEST_CASE: 带--dirty_expire参数挂载失败"
+    exit 1
+fi
+
+touch_and_check "${MNTPOINT}"/file0
+golden_long | tee "${MNTPOINT}"/file0 > /dev/null
+
+# sync带文件参数时对该文件调用fsync
+sync "${MNTPOINT}"/file0
+kill_fuse
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - read ${MNTPOINT}/file0 after fsync and crash"
+core_tester ls "${MNTPOINT}"/file0 check_fsynced "$TEST_CASE"
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,83 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - rm and mv"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+# 删改之后、重新挂载后应看到的目录内容
+# /: dir2 file2
+# /dir2: file3
+RES_ROOT="dir2 file2"
+RES_DIR2="file3"
+
+# 8行约3.5KB，跨4个数据块
+function golden_long () {
+    for _ in 1 2 3 4 5 6 7 8; do
+        echo "$GOLDEN"
+    done
+}
+
+# ls的输出必须与期望完全一致，删掉的文件不能再出现
+function check_exact_ls () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _EXPECT=$3
+
+    OUTPUT=$(ls "$_PARAM" | tr '\n' ' ' | sed 's/ $//')
+    if [[ "$OUTPUT" != "$_EXPECT" ]]; then
+        fail "$_TEST_CASE: ls的输出为[$OUTPUT], 应该为[$_EXPECT]"
+        return 1
+    fi
+    return 0
+}
+
+function check_root () {
+    check_exact_ls "$1" "$2" "$RES_ROOT"
+}
+
+function check_dir2 () {
+    check_exact_ls "$1" "$2" "$RES_DIR2"
+}
+
+function check_moved () {
+    _FILE=$1
+    _TEST_CASE=$2
+
+    if [[ "$(cat "$_FILE")" != "$(golden_long)" ]]; then
+        fail "$_TEST_CASE: 读文件$_FILE成功, 但内容与移动前写入的不同"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/dir0
+touch_and_check "${MNTPOINT}"/dir0/file0
+touch_and_check "${MNTPOINT}"/dir0/file3
+touch_and_check "${MNTPOINT}"/file1
+golden_long | tee "${MNTPOINT}"/dir0/file0 > /dev/null
+echo "$GOLDEN" | tee "${MNTPOINT}"/file1 > /dev/null
+
+rm "${MNTPOINT}"/file1
+mv "${MNTPOINT}"/dir0/file0 "${MNTPOINT}"/file2
+mv "${MNTPOINT}"/dir0 "${MNTPOINT}"/dir2
+
+clean_mount
+
+try_mount_or_fail
+
+TEST_CASE="case 12.1 - ls ${MNTPOINT}/ after rm and mv"
+core_tester ls "${MNTPOINT}"/ check_root "$TEST_CASE"
+
+TEST_CASE="case 12.2 - ls ${MNTPOINT}/dir2 after mv"
+core_tester ls "${MNTPOINT}"/dir2 check_dir2 "$TEST_CASE"
+
+TEST_CASE="case 12.3 - read ${MNTPOINT}/file2 after mv"
+core_tester ls "${MNTPOINT}"/file2 check_moved "$TEST_CASE"
+
+clean_mount
+clean_ddriver
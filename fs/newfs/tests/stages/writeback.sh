@@ -0,0 +1,61 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - writeback"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+# 8行约3.5KB，跨4个数据块
+function golden_long () {
+    for _ in 1 2 3 4 5 6 7 8; do
+        echo "$GOLDEN"
+    done
+}
+
+function check_content () {
+    _FILE=$1
+    _TEST_CASE=$2
+    _EXPECT=$3
+
+    if [[ "$(stat -c %s "$_FILE")" != "$(echo "$_EXPECT" | wc -c)" ]]; then
+        fail "$_TEST_CASE: 文件$_FILE大小为$(stat -c %s "$_FILE"), 应该为$(echo "$_EXPECT" | wc -c)"
+        return 1
+    fi
+    if [[ "$(cat "$_FILE")" != "$_EXPECT" ]]; then
+        fail "$_TEST_CASE: 读文件$_FILE成功, 但内容与写入的不同, 请检查数据块是否写回"
+        return 1
+    fi
+    return 0
+}
+
+function check_long () {
+    check_content "$1" "$2" "$(golden_long)"
+}
+
+function check_short () {
+    check_content "$1" "$2" "$GOLDEN"
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+touch_and_check "${MNTPOINT}"/file0
+touch_and_check "${MNTPOINT}"/file1
+golden_long | tee "${MNTPOINT}"/file0 > /dev/null
+echo "$GOLDEN" | tee "${MNTPOINT}"/file1 > /dev/null
+
+clean_mount
+
+sleep 1
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - read ${MNTPOINT}/file0 after remount"
+core_tester ls "${MNTPOINT}"/file0 check_long "$TEST_CASE"
+
+TEST_CASE="case 8.2 - read ${MNTPOINT}/file1 after remount"
+core_tester ls "${MNTPOINT}"/file1 check_short "$TEST_CASE"
+
+clean_mount
+clean_ddriver
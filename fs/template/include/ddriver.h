@@ -20,7 +20,7 @@ int ddriver_open(char *path);
  * @param whence SEEK_SET即可
  * @return int 0成功，否则失败
  */
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 
 /**
  * @brief 写入数据